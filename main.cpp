@@ -1,12 +1,13 @@
 
 // cpu_monitor.cpp
 // Compile with: 
-//   Linux:   g++ -std=c++17 -O2 cpu_monitor.cpp -o cpu_monitor
+//   Linux:   g++ -std=c++17 -O2 -pthread cpu_monitor.cpp -o cpu_monitor
 //   Windows: cl /std:c++17 /O2 cpu_monitor.cpp PowrProf.lib
 //            (o con MinGW: g++ -std=c++17 -O2 cpu_monitor.cpp -o cpu_monitor -lPowrProf)
 // Nota: En Windows requiere PowrProf.lib para leer MHz por núcleo.
 
 #include <iostream>
+#include <cstdio>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -14,20 +15,75 @@
 #include <map>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdarg>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include <limits>
+#include <cmath>
+#include <regex>
+#include <type_traits>
+#include <variant>
+#include <charconv>
 
 #ifdef _WIN32
   #define NOMINMAX
+  #include <winsock2.h>   // antes que windows.h
+  #include <ws2tcpip.h>
+  #pragma comment(lib, "Ws2_32.lib")
   #include <windows.h>
   #include <powrprof.h>   // CallNtPowerInformation, PROCESSOR_POWER_INFORMATION
   #pragma comment(lib, "PowrProf.lib")
   #include <tlhelp32.h>   // Toolhelp32Snapshot para enumerar procesos
+  #include <psapi.h>      // GetProcessMemoryInfo
+  #pragma comment(lib, "Psapi.lib")
 #else
   #include <dirent.h>
   #include <cstring>
   #include <fstream>
-  #include <regex>
+  #include <fcntl.h>
   #include <unistd.h>
+  #include <cerrno>
   #include <sys/types.h>
+  #include <sys/ioctl.h>
+  #include <termios.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/socket.h>
+  #include <sys/uio.h>
+  #include <netdb.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>   // TCP_NODELAY
+  #include <sys/epoll.h>
+  #include <sys/inotify.h>
+  #include <poll.h>
+  #include <ftw.h>
+  #include <sys/syscall.h>
+  #include <sched.h>         // sched_setaffinity
+  #include <pthread.h>       // pthread_setschedparam
+  #include <linux/perf_event.h>
+  #if __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #define INEX_HAVE_URING 1
+  #endif
+  #if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>  // __rdtsc
+  #endif
+  #include <linux/netlink.h>
+  #include <linux/connector.h>
+  #include <linux/cn_proc.h>
   #include <string>
   #include <ctime>
   #include <stdio.h>
@@ -39,6 +95,47 @@
 
 
 // ---------------------------- Utiles ----------------------------
+static std::atomic<bool> g_stop{false};   // SIGINT/SIGTERM
+static std::atomic<uint64_t> g_allocs{0};  // operator new (para --bench)
+
+static void on_signal(int) { g_stop = true; }
+
+// Reloj monotónico en ns (CLOCK_MONOTONIC / QueryPerformanceCounter).
+static int64_t monotonic_ns() {
+#ifdef _WIN32
+    static const LONGLONG freq = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f.QuadPart; }();
+    LARGE_INTEGER c;
+    QueryPerformanceCounter(&c);
+    return static_cast<int64_t>(c.QuadPart / freq * 1000000000LL + c.QuadPart % freq * 1000000000LL / freq);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+// Añade texto con formato printf al final de dst (sin string temporal).
+static void append_vfmt(std::string& dst, const char *fmt, va_list ap) {
+    size_t old = dst.size();
+    va_list ap2;
+    va_copy(ap2, ap);
+    dst.resize(old + 256);
+    int n = std::vsnprintf(&dst[old], 256, fmt, ap);
+    if (n >= 256) {
+        dst.resize(old + n + 1);
+        std::vsnprintf(&dst[old], n + 1, fmt, ap2);
+    }
+    va_end(ap2);
+    dst.resize(old + (n > 0 ? n : 0));
+}
+
+static void append_fmt(std::string& dst, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    append_vfmt(dst, fmt, ap);
+    va_end(ap);
+}
+
 static std::string human_mhz(double mhz) {
     std::ostringstream os;
     if (mhz >= 1000.0) {
@@ -46,227 +143,6826 @@ static std::string human_mhz(double mhz) {
     } else {
         os << std::fixed << std::setprecision(0) << mhz << " MHz";
     }
-    return os.str();
-}
+    return os.str();
+}
+
+static std::string human_kb(unsigned long long kb) {
+    std::ostringstream os;
+    if (kb >= 1024ull * 1024) {
+        os << std::fixed << std::setprecision(1) << (kb / (1024.0 * 1024.0)) << " GB";
+    } else if (kb >= 1024) {
+        os << std::fixed << std::setprecision(1) << (kb / 1024.0) << " MB";
+    } else {
+        os << kb << " KB";
+    }
+    return os.str();
+}
+
+// Conjunto de backends intercambiables (std::variant): uno se elige al
+// arrancar, por nombre o probando en orden, y el despacho es un std::visit
+// sin llamadas virtuales en el camino caliente. Cada backend declara kName,
+// kProbe (si entra en la prueba automática) y un open(...) que dice si
+// funciona en esta máquina.
+template <class... Backends>
+class BackendSet {
+public:
+    // force: nombre de un backend, o nullptr para el primero con kProbe que abra.
+    template <class... Args>
+    bool open(const char *force, const Args&... args) {
+        return (try_open<Backends>(force, args...) || ...);
+    }
+
+    bool empty() const { return v_.index() == 0; }
+    const char *name() const {
+        return std::visit([](const auto& b) -> const char * {
+            if constexpr (std::is_same_v<std::decay_t<decltype(b)>, std::monostate>) return "ninguno";
+            else return b.kName;
+        }, v_);
+    }
+
+    template <class T> T *get() { return std::get_if<T>(&v_); }
+    template <class T> const T *get() const { return std::get_if<T>(&v_); }
+
+    // f(backend) sobre el backend activo; nada si no hay ninguno.
+    template <class F> void visit(F&& f) {
+        std::visit([&](auto& b) {
+            if constexpr (!std::is_same_v<std::decay_t<decltype(b)>, std::monostate>) f(b);
+        }, v_);
+    }
+
+    static bool known(const char *name) { return ((std::strcmp(name, Backends::kName) == 0) || ...); }
+    static std::string names() {
+        std::string out;
+        ((out += out.empty() ? "" : "|", out += Backends::kName), ...);
+        return out;
+    }
+
+private:
+    template <class T, class... Args>
+    bool try_open(const char *force, const Args&... args) {
+        if (force ? std::strcmp(force, T::kName) != 0 : !T::kProbe) return false;
+        v_.template emplace<T>();
+        if (std::get<T>(v_).open(args...)) return true;
+        v_.template emplace<std::monostate>();  // cierra lo que abriera
+        return false;
+    }
+
+    std::variant<std::monostate, Backends...> v_;
+};
+
+// Pool pequeño para parallel_for con robo de trabajo: [0, n) se reparte en
+// un rango contiguo por worker y cada uno consume trozos de `chunk`
+// índices del suyo con un fetch_add; al vaciarlo roba trozos de los rangos
+// de los demás igual. Sin colas ni locks en el reparto; el mutex solo
+// arranca y cierra cada ronda. Con 1 worker no hay hilos: todo en línea.
+class WorkPool {
+public:
+    WorkPool() : ranges_(1) {}
+    ~WorkPool() { stop(); }
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    // n workers en total (el hilo que llama es el 0).
+    void start(unsigned n) {
+        stop();
+        n = std::max(1u, n);
+        ranges_ = std::vector<Range>(n);
+        stopping_ = false;
+        for (unsigned w = 1; w < n; ++w) threads_.emplace_back([this, w] { worker(w); });
+    }
+
+    unsigned size() const { return static_cast<unsigned>(ranges_.size()); }
+
+    // fn(worker, begin, end) sobre trozos que cubren [0, n); vuelve al terminar.
+    template <class F>
+    void parallel_for(size_t n, size_t chunk, F&& fn) {
+        if (n == 0) return;
+        if (threads_.empty() || n <= chunk) { fn(0u, size_t(0), n); return; }
+        using Fn = std::remove_reference_t<F>;
+        run(n, chunk, [](void *ctx, unsigned w, size_t b, size_t e) { (*static_cast<Fn*>(ctx))(w, b, e); },
+            const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+private:
+    using Trampoline = void (*)(void*, unsigned, size_t, size_t);
+    struct alignas(64) Range { std::atomic<size_t> next{0}; size_t end = 0; };
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+        }
+        start_cv_.notify_all();
+        for (std::thread& t : threads_) t.join();
+        threads_.clear();
+    }
+
+    void run(size_t n, size_t chunk, Trampoline fn, void *ctx) {
+        const size_t nw = ranges_.size();
+        for (size_t w = 0; w < nw; ++w) {
+            ranges_[w].next.store(n * w / nw, std::memory_order_relaxed);
+            ranges_[w].end = n * (w + 1) / nw;
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            fn_ = fn;
+            ctx_ = ctx;
+            chunk_ = chunk;
+            pending_ = nw - 1;
+            ++round_;
+        }
+        start_cv_.notify_all();
+        drain(0);
+        std::unique_lock<std::mutex> lk(mu_);
+        done_cv_.wait(lk, [&] { return pending_ == 0; });
+    }
+
+    void worker(unsigned w) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                start_cv_.wait(lk, [&] { return stopping_ || round_ != seen; });
+                if (stopping_) return;
+                seen = round_;
+            }
+            drain(w);
+            std::lock_guard<std::mutex> lk(mu_);
+            if (--pending_ == 0) done_cv_.notify_one();
+        }
+    }
+
+    // Primero el rango propio, luego los de los demás en orden circular.
+    void drain(unsigned w) {
+        const size_t nw = ranges_.size();
+        for (size_t k = 0; k < nw; ++k) {
+            Range& r = ranges_[(w + k) % nw];
+            for (;;) {
+                const size_t b = r.next.fetch_add(chunk_, std::memory_order_relaxed);
+                if (b >= r.end) break;
+                fn_(ctx_, w, b, std::min(b + chunk_, r.end));
+            }
+        }
+    }
+
+    std::vector<Range> ranges_;
+    std::vector<std::thread> threads_;
+    std::mutex mu_;
+    std::condition_variable start_cv_, done_cv_;
+    bool stopping_ = false;
+    uint64_t round_ = 0;
+    size_t pending_ = 0;
+    Trampoline fn_ = nullptr;
+    void *ctx_ = nullptr;
+    size_t chunk_ = 1;
+};
+
+// ---------------------- Frecuencia por núcleo -------------------
+#ifdef _WIN32
+// Filas de los arrays por CPU: todas las que puede llegar a tener el
+// sistema sumando los grupos de procesadores (con más de 64 CPUs hay más
+// de uno; dwNumberOfProcessors solo cuenta el grupo del proceso).
+static size_t cpu_possible() {
+    return GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS);
+}
+
+// Windows: usar CallNtPowerInformation(ProcessorInformation)
+// Devuelve un array de PROCESSOR_POWER_INFORMATION, uno por lógica de CPU.
+// El buffer se reserva una sola vez (y solo crece si se añaden CPUs en
+// caliente); cada muestra es una única llamada.
+class PowrProfFrequency {
+public:
+    static constexpr const char *kName = "powrprof";
+    static constexpr bool kProbe = true;
+
+    bool open() {
+        nproc_ = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        buffer_.resize(nproc_ * sizeof(PROCESSOR_POWER_INFORMATION));
+        return !sample().empty();
+    }
+
+    const std::vector<double>& sample() {
+        freqs_.clear();
+        if (nproc_ == 0) return freqs_;
+
+        NTSTATUS st = CallNtPowerInformation(ProcessorInformation, nullptr, 0,
+                                             buffer_.data(), static_cast<ULONG>(buffer_.size()));
+        if (st == kStatusBufferTooSmall) {
+            nproc_ = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+            buffer_.resize(nproc_ * sizeof(PROCESSOR_POWER_INFORMATION));
+            st = CallNtPowerInformation(ProcessorInformation, nullptr, 0,
+                                        buffer_.data(), static_cast<ULONG>(buffer_.size()));
+        }
+        if (st != 0) {
+            // Fallback: Win32_Processor->CurrentClockSpeed no es por núcleo; omitimos.
+            return freqs_;
+        }
+
+        auto *ppi = reinterpret_cast<PROCESSOR_POWER_INFORMATION*>(buffer_.data());
+        freqs_.resize(nproc_);
+        for (ULONG i = 0; i < nproc_; ++i) {
+            freqs_[i] = static_cast<double>(ppi[i].CurrentMhz); // MHz actuales por CPU lógica
+        }
+        return freqs_;
+    }
+
+private:
+    static constexpr NTSTATUS kStatusBufferTooSmall = static_cast<NTSTATUS>(0xC0000023L);
+
+    ULONG nproc_ = 0;
+    std::vector<BYTE> buffer_;
+    std::vector<double> freqs_;
+};
+
+// Uso por núcleo: NtQuerySystemInformation(SystemProcessorPerformanceInformation)
+// (ntdll, se resuelve una vez). KernelTime incluye el tiempo idle. Esa
+// llamada solo ve el grupo de procesadores del hilo; con varios grupos se
+// pide cada uno con NtQuerySystemInformationEx y se colocan uno tras otro,
+// en el mismo orden lineal que win_cpu_index.
+struct CoreUtil { double busy = -1, iowait = -1, irq = -1, steal = -1; }; // % ; -1 = N/D
+
+class UtilizationSampler {
+public:
+    UtilizationSampler() {
+        ngroups_ = GetActiveProcessorGroupCount();
+        nproc_ = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        if (HMODULE nt = GetModuleHandleW(L"ntdll.dll")) {
+            query_ = reinterpret_cast<QueryFn>(GetProcAddress(nt, "NtQuerySystemInformation"));
+            query_ex_ = reinterpret_cast<QueryExFn>(GetProcAddress(nt, "NtQuerySystemInformationEx"));
+        }
+        cur_.resize(nproc_);
+        prev_.resize(nproc_);
+    }
+
+    const std::vector<CoreUtil>& sample() {
+        util_.assign(nproc_, CoreUtil{});
+        if (!query_ || nproc_ == 0) return util_;
+        if (!query_all()) return util_;
+
+        for (ULONG i = 0; i < nproc_ && have_prev_; ++i) {
+            double idle = double(cur_[i].IdleTime.QuadPart - prev_[i].IdleTime.QuadPart);
+            double kern = double(cur_[i].KernelTime.QuadPart - prev_[i].KernelTime.QuadPart);
+            double user = double(cur_[i].UserTime.QuadPart - prev_[i].UserTime.QuadPart);
+            double irq  = double(cur_[i].DpcTime.QuadPart - prev_[i].DpcTime.QuadPart)
+                        + double(cur_[i].InterruptTime.QuadPart - prev_[i].InterruptTime.QuadPart);
+            double total = kern + user;
+            if (total <= 0) continue;
+            util_[i].busy = (total - idle) / total * 100.0;
+            util_[i].irq = irq / total * 100.0;
+            util_[i].iowait = 0.0;  // Windows no lo separa
+            util_[i].steal = 0.0;
+        }
+        std::swap(cur_, prev_);
+        have_prev_ = true;
+        return util_;
+    }
+
+private:
+    struct Perf {
+        LARGE_INTEGER IdleTime, KernelTime, UserTime, DpcTime, InterruptTime;
+        ULONG InterruptCount;
+    };
+    using QueryFn = LONG (WINAPI *)(ULONG, PVOID, ULONG, PULONG);
+    using QueryExFn = LONG (WINAPI *)(ULONG, PVOID, ULONG, PVOID, ULONG, PULONG);
+    static constexpr ULONG kSystemProcessorPerformanceInformation = 8;
+
+    bool query_all() {
+        ULONG len = 0;
+        if (ngroups_ <= 1 || !query_ex_)
+            return query_(kSystemProcessorPerformanceInformation, cur_.data(),
+                          static_cast<ULONG>(cur_.size() * sizeof(Perf)), &len) == 0;
+        ULONG base = 0;
+        for (USHORT g = 0; g < ngroups_ && base < nproc_; ++g) {
+            const ULONG n = std::min<ULONG>(GetActiveProcessorCount(g), nproc_ - base);
+            if (query_ex_(kSystemProcessorPerformanceInformation, &g, sizeof(g), &cur_[base],
+                          n * sizeof(Perf), &len) != 0) return false;
+            base += n;
+        }
+        return true;
+    }
+
+    ULONG nproc_ = 0;
+    WORD ngroups_ = 1;
+    QueryFn query_ = nullptr;
+    QueryExFn query_ex_ = nullptr;
+    std::vector<Perf> cur_, prev_;
+    std::vector<CoreUtil> util_;
+    bool have_prev_ = false;
+};
+#else
+// Linux: las fuentes de frecuencia son msr, sysfs cpufreq, /proc/cpuinfo y
+// (bajo demanda) perf; ver FrequencySource.
+
+// Lee un entero decimal de [p, end); ignora espacios iniciales.
+static long parse_long(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    return v;
+}
+
+static unsigned long long parse_ull(const char *p, const char *end) {
+    unsigned long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    return v;
+}
+
+// Lee el fichero entero en buf (sin reservar memoria); devuelve los bytes.
+static ssize_t read_small_file(const char *path, char *buf, size_t cap) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = ::read(fd, buf, cap);
+    ::close(fd);
+    return n;
+}
+
+// Entero (con signo) de un fichero pequeño de sysfs; def si no existe.
+static long read_int_file(const std::string& path, long def) {
+    char buf[64];
+    ssize_t n = read_small_file(path.c_str(), buf, sizeof(buf));
+    if (n <= 0) return def;
+    const char *p = buf, *end = buf + n;
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    if (p < end && *p == '-') return -parse_long(p + 1, end);
+    return parse_long(p, end);
+}
+
+// Fallback: /proc/cpuinfo -> "processor" y "cpu MHz". El fichero entero
+// se lee con pread() en un buffer reutilizable y se recorre por líneas con
+// memchr (vectorizado en glibc/bionic); solo se miran las claves que
+// empiezan por 'p' o 'c' y el resultado va a un vector plano por id.
+class CpuinfoReader {
+public:
+    explicit CpuinfoReader(const char *path = "/proc/cpuinfo")
+        : fd_(::open(path, O_RDONLY | O_CLOEXEC)), buf_(256 * 1024) {}
+    ~CpuinfoReader() { if (fd_ >= 0) ::close(fd_); }
+    CpuinfoReader(const CpuinfoReader&) = delete;
+    CpuinfoReader& operator=(const CpuinfoReader&) = delete;
+
+    // MHz por id de CPU en freqs (reutiliza su capacidad); -1 = N/D.
+    void read(std::vector<double>& freqs) {
+        freqs.clear();
+        const size_t n = read_all();
+        const char *p = buf_.data(), *end = p + n;
+        long cpu = -1;
+        while (p < end) {
+            const char *eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!eol) eol = end;
+            if (*p == 'p' && starts_with(p, eol, "processor")) {
+                cpu = parse_long(value(p, eol), eol);
+            } else if (*p == 'c' && cpu >= 0 && starts_with(p, eol, "cpu MHz")) {
+                if (static_cast<size_t>(cpu) >= freqs.size()) freqs.resize(cpu + 1, -1.0);
+                freqs[cpu] = parse_decimal(value(p, eol), eol);
+            }
+            p = eol + 1;
+        }
+    }
+
+private:
+    static bool starts_with(const char *p, const char *eol, const char (&key)[10]) {
+        return eol - p >= 9 && std::memcmp(p, key, 9) == 0;
+    }
+    static bool starts_with(const char *p, const char *eol, const char (&key)[8]) {
+        return eol - p >= 7 && std::memcmp(p, key, 7) == 0;
+    }
+    // Lo que sigue a ':' en la línea.
+    static const char *value(const char *p, const char *eol) {
+        const char *c = static_cast<const char*>(std::memchr(p, ':', eol - p));
+        return c ? c + 1 : eol;
+    }
+    // "2000.000" sin strtod (que depende del locale).
+    static double parse_decimal(const char *p, const char *end) {
+        while (p < end && (*p == ' ' || *p == '\t')) ++p;
+        double v = 0;
+        while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+        if (p < end && *p == '.') {
+            double scale = 0.1;
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p, scale *= 0.1) v += (*p - '0') * scale;
+        }
+        return v;
+    }
+
+    size_t read_all() {
+        if (fd_ < 0) return 0;
+        for (;;) {
+            ssize_t n = ::pread(fd_, buf_.data(), buf_.size(), 0);
+            if (n <= 0) return 0;
+            if (static_cast<size_t>(n) < buf_.size()) return static_cast<size_t>(n);
+            buf_.resize(buf_.size() * 2);  // solo en máquinas enormes
+        }
+    }
+
+    int fd_;
+    std::vector<char> buf_;
+};
+
+static const char kSysCpuRoot[] = "/sys/devices/system/cpu";
+
+// Formato cpulist del kernel: "0-3,8,10-11".
+static void parse_cpulist(const char *p, const char *end, std::vector<int>& out) {
+    out.clear();
+    while (p < end) {
+        while (p < end && (*p < '0' || *p > '9')) ++p;
+        if (p >= end) break;
+        const char *s = p;
+        while (p < end && *p >= '0' && *p <= '9') ++p;
+        long a = parse_long(s, p), b = a;
+        if (p < end && *p == '-') {
+            s = ++p;
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+            b = parse_long(s, p);
+        }
+        for (long c = a; c <= b; ++c) out.push_back(static_cast<int>(c));
+    }
+}
+
+// Ids N de los subdirectorios "<prefix>N" de dir, ordenados.
+static void list_numbered_dirs(const std::string& dir, const char *prefix, std::vector<int>& out) {
+    out.clear();
+    const size_t plen = std::strlen(prefix);
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d)) != nullptr) {
+        const char *n = de->d_name;
+        if (std::strncmp(n, prefix, plen) != 0 || n[plen] == '\0') continue;
+        const char *p = n + plen;
+        while (*p >= '0' && *p <= '9') ++p;
+        if (*p != '\0') continue;
+        out.push_back(static_cast<int>(parse_long(n + plen, p)));
+    }
+    closedir(d);
+    std::sort(out.begin(), out.end());
+}
+
+// Fichero de sysfs entero en buf (crece si hace falta); false si no existe.
+static bool read_sysfs_text(int fd, std::vector<char>& buf, size_t& len) {
+    len = 0;
+    if (fd < 0) return false;
+    if (buf.empty()) buf.resize(256);
+    for (;;) {
+        const ssize_t n = ::pread(fd, buf.data(), buf.size(), 0);
+        if (n < 0) return false;
+        if (static_cast<size_t>(n) < buf.size()) { len = static_cast<size_t>(n); return true; }
+        buf.resize(buf.size() * 2);   // miles de CPUs con huecos
+    }
+}
+
+// Modelo de las CPUs lógicas de <root>, uno por raíz y compartido
+// (CpuSet::at) por los backends de frecuencia, los térmicos y la
+// topología: present (o los directorios cpu[0-9]+ si no existe), el estado
+// de online y possible, que da el tamaño de los arrays por id y no cambia
+// en toda la vida del sistema. Sobre el sysfs real hay un único socket
+// NETLINK_KOBJECT_UEVENT: update() es un recv() sin bloquear y online solo
+// se relee con un uevent de SUBSYSTEM=cpu o cada kPollNs (un contenedor
+// puede no recibir los uevents del host); sin socket, un pread() por
+// llamada. Cada cambio incrementa generation() y cada backend reabre
+// cuando ve una distinta de la suya. Solo lo usa el hilo muestreador (y el
+// principal antes de arrancarlo).
+class CpuSet {
+public:
+    static constexpr int64_t kPollNs = 1000000000LL;
+
+    static CpuSet& at(const std::string& root = kSysCpuRoot) {
+        static std::mutex mu;
+        static std::map<std::string, std::unique_ptr<CpuSet>> sets;
+        std::lock_guard<std::mutex> lock(mu);
+        std::unique_ptr<CpuSet>& s = sets[root];
+        if (!s) s.reset(new CpuSet(root));
+        return *s;
+    }
+
+    ~CpuSet() {
+        if (online_fd_ >= 0) ::close(online_fd_);
+        if (uevent_fd_ >= 0) ::close(uevent_fd_);
+    }
+    CpuSet(const CpuSet&) = delete;
+    CpuSet& operator=(const CpuSet&) = delete;
+
+    const std::string& root() const { return root_; }
+    uint64_t generation() const { return gen_; }
+
+    // Ids ordenados de las CPUs presentes; vacío si no hay ni present ni cpu*.
+    const std::vector<int>& present() const { return cpus_; }
+
+    // Online según el último online leído (sin fichero: todas).
+    bool online(int id) const {
+        if (online_fd_ < 0) return true;
+        return id >= 0 && static_cast<size_t>(id) < online_mask_.size() && online_mask_[id];
+    }
+
+    // Filas de los arrays por id: possible si se sabe, si no el mayor id + 1.
+    size_t capacity() const {
+        return std::max(possible_, cpus_.empty() ? size_t(0) : static_cast<size_t>(cpus_.back()) + 1);
+    }
+
+    // Por muestra: atiende el hotplug y devuelve la generación actual.
+    uint64_t update() {
+        bool changed = force_;
+        force_ = false;
+        if (uevent_fd_ >= 0) {
+            const int64_t now = monotonic_ns();
+            if (drain_uevents() || now - poll_ns_ >= kPollNs) {
+                poll_ns_ = now;
+                changed |= reread_online();
+            }
+        } else {
+            changed |= reread_online();
+        }
+        if (changed) {
+            read_present();
+            ++gen_;
+        }
+        return gen_;
+    }
+
+    // Un backend vio un fd que dejó de valer: relectura completa en update().
+    void force() { force_ = true; }
+
+private:
+    explicit CpuSet(std::string root) : root_(std::move(root)) {
+        std::vector<char> buf;
+        std::vector<int> ids;
+        size_t len = 0;
+        const int fd = ::open((root_ + "/possible").c_str(), O_RDONLY | O_CLOEXEC);
+        if (read_sysfs_text(fd, buf, len)) parse_cpulist(buf.data(), buf.data() + len, ids);
+        if (fd >= 0) ::close(fd);
+        possible_ = ids.empty() ? 0 : static_cast<size_t>(ids.back()) + 1;
+
+        online_fd_ = ::open((root_ + "/online").c_str(), O_RDONLY | O_CLOEXEC);
+        read_sysfs_text(online_fd_, online_, online_len_);
+        parse_online();
+        read_present();
+        if (root_ == kSysCpuRoot) subscribe();   // los uevents son del sysfs real
+        poll_ns_ = monotonic_ns();
+    }
+
+    void read_present() {
+        const int fd = ::open((root_ + "/present").c_str(), O_RDONLY | O_CLOEXEC);
+        size_t len = 0;
+        if (read_sysfs_text(fd, text_, len)) parse_cpulist(text_.data(), text_.data() + len, cpus_);
+        else cpus_.clear();
+        if (fd >= 0) ::close(fd);
+        if (cpus_.empty()) list_numbered_dirs(root_, "cpu", cpus_);
+    }
+
+    bool reread_online() {
+        size_t len = 0;
+        read_sysfs_text(online_fd_, text_, len);
+        if (len == online_len_ && std::equal(text_.begin(), text_.begin() + len, online_.begin())) return false;
+        online_.swap(text_);
+        online_len_ = len;
+        parse_online();
+        return true;
+    }
+
+    void parse_online() {
+        parse_cpulist(online_.data(), online_.data() + online_len_, ids_);
+        std::fill(online_mask_.begin(), online_mask_.end(), 0);
+        if (!ids_.empty() && static_cast<size_t>(ids_.back()) >= online_mask_.size())
+            online_mask_.resize(ids_.back() + 1, 0);
+        for (int id : ids_) online_mask_[id] = 1;
+    }
+
+    void subscribe() {
+        const int fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        if (fd < 0) return;
+        sockaddr_nl sa{};
+        sa.nl_family = AF_NETLINK;
+        sa.nl_groups = 1;   // uevents del kernel (no los reenviados por udevd)
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0) { ::close(fd); return; }
+        uevent_fd_ = fd;
+    }
+
+    // true si llegó algún uevent de CPU (o se perdieron eventos).
+    bool drain_uevents() {
+        bool cpu = false;
+        char buf[4096];
+        for (;;) {
+            const ssize_t n = ::recv(uevent_fd_, buf, sizeof(buf), 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == ENOBUFS) { cpu = true; continue; }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) { ::close(uevent_fd_); uevent_fd_ = -1; cpu = true; }
+                return cpu;
+            }
+            // "accion@devpath\0CLAVE=valor\0..."
+            for (const char *p = buf, *end = buf + n; p < end; p += std::strlen(p) + 1)
+                if (std::strcmp(p, "SUBSYSTEM=cpu") == 0) { cpu = true; break; }
+        }
+    }
+
+    std::string root_;
+    std::vector<int> cpus_, ids_;
+    std::vector<uint8_t> online_mask_;
+    std::vector<char> online_, text_;
+    size_t online_len_ = 0;
+    size_t possible_ = 0;
+    int online_fd_ = -1;
+    int uevent_fd_ = -1;
+    int64_t poll_ns_ = 0;
+    uint64_t gen_ = 1;
+    bool force_ = false;
+};
+
+// Tamaño de los arrays por id de CPU del sistema (ver CpuSet::capacity).
+static size_t cpu_possible() { return CpuSet::at().capacity(); }
+
+// sysfs: un fd abierto por cpu*/cpufreq/scaling_cur_freq; cada muestra es
+// un pread() por núcleo sobre un buffer fijo.
+class SysfsFrequency {
+public:
+    static constexpr const char *kName = "sysfs";
+    static constexpr bool kProbe = true;
+
+    explicit SysfsFrequency(const std::string& root = kSysCpuRoot) : set_(CpuSet::at(root)) {}
+    ~SysfsFrequency() { close_all(); }
+    SysfsFrequency(const SysfsFrequency&) = delete;
+    SysfsFrequency& operator=(const SysfsFrequency&) = delete;
+
+    // Sirve si al menos un núcleo da una lectura válida.
+    bool open() {
+        reopen();
+        if (nfds_ == 0) return false;
+        for (double mhz : sample()) if (mhz > 0) return true;
+        return false;
+    }
+
+    // MHz por CPU lógica (indexado por id); -1 = N/D. Con due solo se
+    // releen los núcleos marcados; los demás conservan el valor anterior.
+    const std::vector<double>& sample(const std::vector<uint8_t> *due = nullptr) {
+        if (set_.update() != gen_) reopen();
+        bool stale = false;
+        for (size_t id = 0; id < fds_.size(); ++id) {
+            if (due && id < due->size() && !(*due)[id]) continue;
+            freqs_[id] = -1.0;
+            if (fds_[id] < 0) continue;
+            ssize_t n = ::pread(fds_[id], buf_, sizeof(buf_), 0);
+            if (n <= 0) { stale = true; continue; }
+            long khz = parse_long(buf_, buf_ + n);
+            if (khz > 0) freqs_[id] = khz / 1000.0; // a MHz
+        }
+        if (stale) set_.force();
+        return freqs_;
+    }
+
+private:
+    void close_all() {
+        for (int fd : fds_) if (fd >= 0) ::close(fd);
+        fds_.clear();
+        nfds_ = 0;
+    }
+
+    void reopen() {
+        close_all();
+        gen_ = set_.generation();
+        const std::vector<int>& cpus = set_.present();
+        const size_t n = cpus.empty() ? 0 : cpus.back() + 1;
+        // reservado a possible: un hotplug no vuelve a reservar
+        fds_.reserve(set_.capacity());
+        freqs_.reserve(set_.capacity());
+        fds_.assign(n, -1);
+        freqs_.assign(n, -1.0);
+        for (int id : cpus) {
+            if (!set_.online(id)) continue;   // su cpufreq fallaría en cada muestra
+            std::string p = set_.root() + "/cpu" + std::to_string(id) + "/cpufreq/scaling_cur_freq";
+            fds_[id] = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fds_[id] >= 0) ++nfds_;
+        }
+    }
+
+    CpuSet& set_;
+    uint64_t gen_ = 0;
+    std::vector<int> fds_;      // un fd por id de CPU; -1 si no hay cpufreq
+    size_t nfds_ = 0;
+    std::vector<double> freqs_;
+    char buf_[32];
+};
+
+// msr: IA32_APERF/IA32_MPERF por /dev/cpu/N/msr (módulo msr, root). El
+// cociente de deltas por la frecuencia base es la frecuencia media que
+// entregó el núcleo durante el intervalo mientras estaba en C0; ve el
+// throttling que cpufreq no refleja. AMD usa las mismas direcciones.
+class MsrFrequency {
+public:
+    static constexpr const char *kName = "msr";
+    static constexpr bool kProbe = true;
+
+    explicit MsrFrequency(std::string root = kSysCpuRoot, std::string msr_root = "/dev/cpu")
+        : set_(CpuSet::at(root)), msr_root_(std::move(msr_root)) {}
+    ~MsrFrequency() { close_all(); }
+    MsrFrequency(const MsrFrequency&) = delete;
+    MsrFrequency& operator=(const MsrFrequency&) = delete;
+
+    // Sirve si hay algún /dev/cpu/N/msr legible y se conoce la base.
+    bool open() {
+        reopen();
+        for (const Msr& m : msr_) {
+            if (m.fd < 0 || !m.primed) continue;
+            base_mhz_ = detect_base_mhz(m.fd);
+            return base_mhz_ > 0;
+        }
+        return false;
+    }
+
+    // Como en sysfs, due limita los núcleos releídos; el siguiente delta de
+    // un núcleo saltado cubre todo el tiempo desde su última lectura.
+    const std::vector<double>& sample(const std::vector<uint8_t> *due = nullptr) {
+        if (set_.update() != gen_) reopen();
+        for (size_t id = 0; id < msr_.size(); ++id) {
+            if (due && id < due->size() && !(*due)[id]) continue;
+            freqs_[id] = -1.0;
+            Msr& m = msr_[id];
+            uint64_t aperf, mperf;
+            if (m.fd < 0 || !read_msr(m.fd, kMsrAperf, aperf) || !read_msr(m.fd, kMsrMperf, mperf)) continue;
+            // Un núcleo en idle todo el intervalo no avanza ninguno: N/D.
+            if (m.primed && mperf > m.mperf)
+                freqs_[id] = base_mhz_ * double(aperf - m.aperf) / double(mperf - m.mperf);
+            m.aperf = aperf;
+            m.mperf = mperf;
+            m.primed = true;
+        }
+        return freqs_;
+    }
+
+private:
+    static constexpr off_t kMsrMperf = 0xE7, kMsrAperf = 0xE8;
+    static constexpr off_t kMsrPlatformInfo = 0xCE;   // Intel: ratio base en 15:8
+    static constexpr off_t kMsrAmdPstate0 = 0xC0010064;
+
+    struct Msr {
+        int fd = -1;
+        uint64_t aperf = 0, mperf = 0;  // lectura anterior
+        bool primed = false;
+    };
+
+    static bool read_msr(int fd, off_t reg, uint64_t& v) {
+        return ::pread(fd, &v, sizeof(v), reg) == static_cast<ssize_t>(sizeof(v));
+    }
+
+    // Frecuencia a la que cuenta MPERF (la nominal). 0 si no se sabe.
+    double detect_base_mhz(int fd) const {
+        uint64_t v;
+        if (read_msr(fd, kMsrPlatformInfo, v) && ((v >> 8) & 0xFF) != 0)
+            return ((v >> 8) & 0xFF) * 100.0;
+        // AMD Zen: P0 = CpuFid[7:0] * 200 / CpuDfsId[13:8] MHz
+        if (read_msr(fd, kMsrAmdPstate0, v) && (v >> 63) && ((v >> 8) & 0x3F) != 0)
+            return (v & 0xFF) * 200.0 / ((v >> 8) & 0x3F);
+        long khz = read_int_file(set_.root() + "/cpu0/cpufreq/base_frequency", 0);
+        return khz > 0 ? khz / 1000.0 : 0.0;
+    }
+
+    void close_all() {
+        for (const Msr& m : msr_) if (m.fd >= 0) ::close(m.fd);
+        msr_.clear();
+    }
+
+    void reopen() {
+        close_all();
+        gen_ = set_.generation();
+        const std::vector<int>& cpus = set_.present();
+        const size_t n = cpus.empty() ? 0 : cpus.back() + 1;
+        msr_.reserve(set_.capacity());
+        freqs_.reserve(set_.capacity());
+        msr_.assign(n, Msr{});
+        freqs_.assign(n, -1.0);
+        for (int id : cpus) {
+            if (!set_.online(id)) continue;
+            const std::string p = msr_root_ + "/" + std::to_string(id) + "/msr";
+            Msr& m = msr_[id];
+            m.fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+            // la primera muestra ya cubre desde aquí
+            m.primed = m.fd >= 0 && read_msr(m.fd, kMsrAperf, m.aperf) && read_msr(m.fd, kMsrMperf, m.mperf);
+        }
+    }
+
+    CpuSet& set_;
+    uint64_t gen_ = 0;
+    std::string msr_root_;
+    std::vector<Msr> msr_;
+    std::vector<double> freqs_;
+    double base_mhz_ = 0;
+};
+
+// cpuinfo: "cpu MHz" de /proc/cpuinfo; el último recurso.
+class CpuinfoFrequency {
+public:
+    static constexpr const char *kName = "cpuinfo";
+    static constexpr bool kProbe = true;
+
+    bool open() { return !sample().empty(); }
+    const std::vector<double>& sample() {
+        reader_.read(freqs_);
+        return freqs_;
+    }
+
+private:
+    CpuinfoReader reader_;
+    std::vector<double> freqs_;
+};
+
+// Uso por núcleo a partir de las líneas "cpuN" de /proc/stat:
+// user nice system idle iowait irq softirq steal (guest ya va en user).
+// Un solo pread() por muestra sobre un buffer reutilizable y parseo sin
+// reservas; los porcentajes salen del delta entre dos muestras.
+struct CoreUtil { double busy = -1, iowait = -1, irq = -1, steal = -1; }; // % ; -1 = N/D
+
+class UtilizationSampler {
+public:
+    explicit UtilizationSampler(const char *path = "/proc/stat")
+        : fd_(::open(path, O_RDONLY | O_CLOEXEC)), buf_(64 * 1024) {}
+    ~UtilizationSampler() { if (fd_ >= 0) ::close(fd_); }
+    UtilizationSampler(const UtilizationSampler&) = delete;
+    UtilizationSampler& operator=(const UtilizationSampler&) = delete;
+
+    // Indexado por id de CPU; vacío si /proc/stat no se puede leer.
+    const std::vector<CoreUtil>& sample() {
+        size_t n = read_all();
+        if (n == 0) { util_.clear(); return util_; }
+
+        for (auto& c : cur_) c.valid = false;
+        const char *p = buf_.data(), *end = p + n;
+        while (p < end) {
+            const char *eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!eol) eol = end;
+            if (eol - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u' && p[3] >= '0' && p[3] <= '9')
+                parse_line(p + 3, eol);
+            else if (p[0] != 'c')
+                break;  // las líneas cpu* van al principio
+            p = eol + 1;
+        }
+
+        util_.resize(cur_.size());
+        for (size_t i = 0; i < cur_.size(); ++i) {
+            util_[i] = CoreUtil{};
+            const Counters& c = cur_[i];
+            const Counters& o = prev_[i];
+            if (!c.valid || !o.valid) continue;
+            unsigned long long d[kFields], total = 0;
+            for (int k = 0; k < kFields; ++k) {
+                d[k] = c.v[k] >= o.v[k] ? c.v[k] - o.v[k] : 0;
+                total += d[k];
+            }
+            if (total == 0) continue;
+            const double t = static_cast<double>(total);
+            util_[i].busy = (total - d[kIdle] - d[kIowait]) / t * 100.0;
+            util_[i].iowait = d[kIowait] / t * 100.0;
+            util_[i].irq = (d[kIrq] + d[kSoftirq]) / t * 100.0;
+            util_[i].steal = d[kSteal] / t * 100.0;
+        }
+        std::swap(cur_, prev_);
+        return util_;
+    }
+
+private:
+    enum { kUser, kNice, kSystem, kIdle, kIowait, kIrq, kSoftirq, kSteal, kFields };
+    struct Counters { unsigned long long v[kFields]; bool valid = false; };
+
+    size_t read_all() {
+        if (fd_ < 0) return 0;
+        for (;;) {
+            ssize_t n = ::pread(fd_, buf_.data(), buf_.size(), 0);
+            if (n <= 0) return 0;
+            if (static_cast<size_t>(n) < buf_.size()) return static_cast<size_t>(n);
+            buf_.resize(buf_.size() * 2);  // solo crece con la primera muestra
+        }
+    }
+
+    void parse_line(const char *p, const char *eol) {
+        const char *q = p;
+        while (q < eol && *q >= '0' && *q <= '9') ++q;
+        size_t id = static_cast<size_t>(parse_long(p, q));
+        if (id >= cur_.size()) { cur_.resize(id + 1); prev_.resize(id + 1); }
+        Counters& c = cur_[id];
+        for (int k = 0; k < kFields; ++k) {
+            while (q < eol && *q == ' ') ++q;
+            const char *s = q;
+            while (q < eol && *q >= '0' && *q <= '9') ++q;
+            c.v[k] = 0;
+            for (; s < q; ++s) c.v[k] = c.v[k] * 10 + (*s - '0');
+        }
+        c.valid = true;
+    }
+
+    int fd_;
+    std::vector<char> buf_;
+    std::vector<Counters> cur_, prev_;
+    std::vector<CoreUtil> util_;
+};
+#endif
+
+// ----------------------- Contadores hardware ----------------------
+// --perf: un grupo perf_event_open por CPU con cycles como líder más
+// instructions, ref-cycles y, si el PMU los tiene, LLC misses y stalled
+// cycles (backend). Cada muestra es un read() del grupo completo por CPU.
+// Frecuencia efectiva = cycles / ref-cycles * frecuencia base (lo que el
+// núcleo corrió realmente mientras no estaba en idle); sin frecuencia base
+// conocida se da la media entregada, cycles / tiempo.
+struct CoreCounters { float ipc = -1, stall = -1, mpki = -1; };  // -1 = N/D
+
+#ifndef _WIN32
+// Windows no expone los PMU sin un driver propio: no hay backend perf.
+class PerfFrequency {
+public:
+    static constexpr const char *kName = "perf";
+    static constexpr bool kProbe = false;
+
+    explicit PerfFrequency(const std::string& root = kSysCpuRoot) : set_(CpuSet::at(root)) {}
+    ~PerfFrequency() {
+        for (Cpu& c : cpus_)
+            for (int fd : c.fd) if (fd >= 0) ::close(fd);
+    }
+    PerfFrequency(const PerfFrequency&) = delete;
+    PerfFrequency& operator=(const PerfFrequency&) = delete;
+
+    // false si no se pudo abrir ninguna CPU (sin PMU, sin permisos...).
+    bool open() {
+        cpus_.reserve(set_.capacity());
+        if (rescan() == 0) return false;
+        buf_.resize(3 + kEvents);
+
+        // frecuencia base: intel_pstate la publica; si no, la tasa del TSC
+        long khz = read_int_file(set_.root() + "/cpu0/cpufreq/base_frequency", 0);
+        if (khz > 0) base_mhz_ = khz / 1000.0;
+#if defined(__x86_64__) || defined(__i386__)
+        tsc0_ = __rdtsc();
+        tsc_t0_ = monotonic_ns();
+#endif
+        return true;
+    }
+
+    const std::vector<double>& sample() {
+        update_base();
+        if (set_.update() != gen_) rescan();
+        for (size_t c = 0; c < cpus_.size(); ++c) {
+            Cpu& cpu = cpus_[c];
+            mhz_[c] = -1.0;
+            hw_[c] = CoreCounters{};
+            if (cpu.fd[kCycles] < 0) continue;
+            const size_t want = (3 + cpu.n) * sizeof(uint64_t);
+            if (::read(cpu.fd[kCycles], buf_.data(), want) != static_cast<ssize_t>(want)) continue;
+
+            // buf_: nr, time_enabled, time_running, valores en orden de apertura
+            uint64_t cur[kEvents] = {};
+            for (int e = 0; e < kEvents; ++e)
+                if (cpu.pos[e] >= 0) cur[e] = buf_[3 + cpu.pos[e]];
+            const uint64_t running = buf_[2];
+            if (cpu.have_prev && running > cpu.prev_running) {
+                const double dc = double(cur[kCycles] - cpu.prev[kCycles]);
+                const double dt = double(running - cpu.prev_running);  // ns
+                const double di = double(cur[kInstr] - cpu.prev[kInstr]);
+                const double dr = double(cur[kRef] - cpu.prev[kRef]);
+                if (base_mhz_ > 0 && cpu.pos[kRef] >= 0 && dr > 0) mhz_[c] = dc / dr * base_mhz_;
+                else if (dc > 0) mhz_[c] = dc / dt * 1000.0;
+                if (dc > 0 && cpu.pos[kInstr] >= 0) hw_[c].ipc = static_cast<float>(di / dc);
+                if (dc > 0 && cpu.pos[kStall] >= 0)
+                    hw_[c].stall = static_cast<float>(double(cur[kStall] - cpu.prev[kStall]) / dc);
+                if (di > 0 && cpu.pos[kLlc] >= 0)
+                    hw_[c].mpki = static_cast<float>(double(cur[kLlc] - cpu.prev[kLlc]) / di * 1000.0);
+            }
+            std::memcpy(cpu.prev, cur, sizeof(cur));
+            cpu.prev_running = running;
+            cpu.have_prev = true;
+        }
+        return mhz_;
+    }
+
+    const std::vector<CoreCounters>& counters() const { return hw_; }
+
+private:
+    enum { kCycles, kInstr, kRef, kLlc, kStall, kEvents };
+    struct Cpu {
+        int fd[kEvents] = { -1, -1, -1, -1, -1 };
+        int pos[kEvents] = { -1, -1, -1, -1, -1 };  // posición en la lectura del grupo
+        int n = 0;
+        uint64_t prev[kEvents] = {};
+        uint64_t prev_running = 0;
+        bool have_prev = false;
+    };
+
+    static int open_event(uint64_t config, int cpu, int group_fd) {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = group_fd < 0;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, -1, cpu, group_fd, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    static bool open_cpu(Cpu& cpu, int c) {
+        cpu.fd[kCycles] = open_event(PERF_COUNT_HW_CPU_CYCLES, c, -1);
+        if (cpu.fd[kCycles] < 0) return false;  // sin PMU
+        cpu.pos[kCycles] = cpu.n++;
+        static const uint64_t cfg[kEvents] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_REF_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES,
+                                               PERF_COUNT_HW_STALLED_CYCLES_BACKEND };
+        for (int e = kInstr; e < kEvents; ++e) {
+            cpu.fd[e] = open_event(cfg[e], c, cpu.fd[kCycles]);
+            if (cpu.fd[e] >= 0) cpu.pos[e] = cpu.n++;
+        }
+        ::ioctl(cpu.fd[kCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    static void close_cpu(Cpu& cpu) {
+        for (int fd : cpu.fd) if (fd >= 0) ::close(fd);
+        cpu = Cpu{};
+    }
+
+    // Grupo abierto para cada CPU online y cerrado para las que salieron
+    // (uno sobre una CPU offline no cuenta); las que no cambiaron conservan
+    // sus contadores. Devuelve las CPUs con grupo.
+    size_t rescan() {
+        gen_ = set_.generation();
+        const std::vector<int>& ids = set_.present();
+        const size_t ncpu = ids.empty() ? 0 : ids.back() + 1;
+        if (ncpu > cpus_.size()) cpus_.resize(ncpu);
+        size_t opened = 0;
+        for (size_t c = 0; c < cpus_.size(); ++c) {
+            Cpu& cpu = cpus_[c];
+            const bool on = c < ncpu && std::binary_search(ids.begin(), ids.end(), static_cast<int>(c))
+                            && set_.online(static_cast<int>(c));
+            if (!on) { if (cpu.fd[kCycles] >= 0) close_cpu(cpu); continue; }
+            if (cpu.fd[kCycles] >= 0 || open_cpu(cpu, static_cast<int>(c))) ++opened;
+        }
+        mhz_.resize(cpus_.size(), -1.0);
+        hw_.resize(cpus_.size(), CoreCounters{});
+        return opened;
+    }
+
+    // Mide la tasa del TSC (= ref-cycles en Intel) durante el primer segundo.
+    void update_base() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (base_mhz_ > 0 || tsc_t0_ == 0) return;
+        const int64_t dt = monotonic_ns() - tsc_t0_;
+        if (dt >= 1000000000LL) base_mhz_ = double(__rdtsc() - tsc0_) / dt * 1000.0;
+#endif
+    }
+
+    CpuSet& set_;
+    uint64_t gen_ = 0;
+    std::vector<Cpu> cpus_;
+    std::vector<uint64_t> buf_;
+    std::vector<double> mhz_;
+    std::vector<CoreCounters> hw_;
+    double base_mhz_ = 0;
+    uint64_t tsc0_ = 0;
+    int64_t tsc_t0_ = 0;
+};
+#endif
+
+// --------------------- Eventos de frecuencia ---------------------
+// --freq-source tracepoint: en vez de releer la frecuencia de cada núcleo
+// en cada tick, se suscribe a los tracepoints power:cpu_frequency y
+// power:cpu_idle con perf_event_open (uno de cada por CPU, los dos
+// volcando al mismo ring buffer mmap de esa CPU). El estado por núcleo solo
+// cambia cuando llega un evento, con su marca de tiempo exacta
+// (CLOCK_MONOTONIC); sample() se limita a vaciar los rings y, si no hubo
+// cambios, no hace ni una llamada al sistema. El valor inicial sale de
+// sysfs (o de cpuinfo) al abrir. Necesita tracefs montado y permisos de
+// perf sobre tracepoints. En Windows no hay equivalente: ETW necesita una
+// sesión de trazas propia y se sigue con el sondeo de powrprof.
+struct CoreTransitions {
+    uint32_t changes = 0;   // cambios de frecuencia desde el arranque
+    uint32_t idle = 0;      // entradas en idle desde el arranque
+    int64_t last_ns = 0;    // CLOCK_MONOTONIC del último cambio; 0 = ninguno
+};
+
+#ifndef _WIN32
+class TracepointFrequency {
+public:
+    static constexpr const char *kName = "tracepoint";
+    static constexpr bool kProbe = false;
+    static const size_t kRingPages = 16;    // por CPU, sin contar la de control
+
+    explicit TracepointFrequency(std::string root = kSysCpuRoot) : root_(std::move(root)) {}
+    ~TracepointFrequency() { close_all(); }
+    TracepointFrequency(const TracepointFrequency&) = delete;
+    TracepointFrequency& operator=(const TracepointFrequency&) = delete;
+
+    bool open() {
+        static const char *const tracefs[] = { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" };
+        bool found = false;
+        for (const char *t : tracefs)
+            if ((found = load_event(t, "cpu_frequency", freq_) && load_event(t, "cpu_idle", idle_))) break;
+        if (!found) { errno = ENOENT; return false; }
+
+        CpuSet& set = CpuSet::at(root_);
+        const std::vector<int>& ids = set.present();
+        const size_t ncpu = ids.empty() ? 0 : ids.back() + 1;
+        page_ = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t opened = 0;
+        for (int c : ids) {
+            if (!set.online(c)) continue;
+            Ring r;
+            r.fd = open_event(freq_.id, c);
+            if (r.fd < 0) continue;
+            r.idle_fd = open_event(idle_.id, c);
+            void *m = ::mmap(nullptr, (kRingPages + 1) * page_, PROT_READ | PROT_WRITE, MAP_SHARED, r.fd, 0);
+            if (m == MAP_FAILED) {
+                ::close(r.fd);
+                if (r.idle_fd >= 0) ::close(r.idle_fd);
+                continue;
+            }
+            r.meta = static_cast<perf_event_mmap_page*>(m);
+            if (r.idle_fd >= 0 && ::ioctl(r.idle_fd, PERF_EVENT_IOC_SET_OUTPUT, r.fd) < 0) {
+                ::close(r.idle_fd);
+                r.idle_fd = -1;
+            }
+            rings_.push_back(r);
+            ++opened;
+        }
+        if (opened == 0) { close_all(); return false; }
+
+        // estado de partida: sysfs si hay cpufreq; si no, cpuinfo
+        SysfsFrequency sysfs(root_);
+        CpuinfoFrequency cpuinfo;
+        if (sysfs.open()) mhz_ = sysfs.sample();
+        else if (cpuinfo.open()) mhz_ = cpuinfo.sample();
+        mhz_.resize(std::max(mhz_.size(), ncpu), -1.0);
+        trans_.assign(mhz_.size(), CoreTransitions{});
+
+        for (const Ring& r : rings_) {
+            ::ioctl(r.fd, PERF_EVENT_IOC_ENABLE, 0);
+            if (r.idle_fd >= 0) ::ioctl(r.idle_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        return true;
+    }
+
+    const std::vector<double>& sample() {
+        for (Ring& r : rings_) drain(r);
+        return mhz_;
+    }
+
+    const std::vector<CoreTransitions>& transitions() const { return trans_; }
+    uint64_t lost() const { return lost_; }
+
+private:
+    struct Event { uint16_t id = 0; uint32_t state_off = 8, cpu_off = 12; };
+    struct Ring {
+        int fd = -1, idle_fd = -1;
+        perf_event_mmap_page *meta = nullptr;
+    };
+
+    // id y desplazamientos de state/cpu_id según el fichero format.
+    static bool load_event(const char *tracefs, const char *name, Event& ev) {
+        char path[160], buf[2048];
+        std::snprintf(path, sizeof(path), "%s/events/power/%s/id", tracefs, name);
+        const long id = read_int_file(path, -1);
+        if (id <= 0 || id > 0xFFFF) return false;
+        ev.id = static_cast<uint16_t>(id);
+        std::snprintf(path, sizeof(path), "%s/events/power/%s/format", tracefs, name);
+        const ssize_t n = read_small_file(path, buf, sizeof(buf) - 1);
+        if (n <= 0) return true;    // sin format: el diseño de siempre
+        buf[n] = '\0';
+        auto offset_of = [&](const char *field, uint32_t& off) {
+            const char *p = std::strstr(buf, field);
+            if (p && (p = std::strstr(p, "offset:"))) off = static_cast<uint32_t>(std::atoi(p + 7));
+        };
+        offset_of(" state;", ev.state_off);
+        offset_of(" cpu_id;", ev.cpu_off);
+        return true;
+    }
+
+    static int open_event(uint16_t id, int cpu) {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        attr.sample_period = 1;
+        attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+        attr.disabled = 1;
+        attr.use_clockid = 1;
+        attr.clockid = CLOCK_MONOTONIC;
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    void close_all() {
+        for (Ring& r : rings_) {
+            if (r.meta) ::munmap(r.meta, (kRingPages + 1) * page_);
+            if (r.idle_fd >= 0) ::close(r.idle_fd);
+            if (r.fd >= 0) ::close(r.fd);
+        }
+        rings_.clear();
+    }
+
+    // Copia len bytes desde la posición pos del ring de datos (puede dar la vuelta).
+    void copy_out(const Ring& r, uint64_t pos, void *dst, size_t len) const {
+        const char *data = reinterpret_cast<const char*>(r.meta) + page_;
+        const size_t size = kRingPages * page_;
+        const size_t off = static_cast<size_t>(pos % size);
+        const size_t first = std::min(len, size - off);
+        std::memcpy(dst, data + off, first);
+        std::memcpy(static_cast<char*>(dst) + first, data, len - first);
+    }
+
+    void drain(Ring& r) {
+        const uint64_t head = __atomic_load_n(&r.meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = r.meta->data_tail;
+        char rec[256];
+        while (tail < head) {
+            perf_event_header h;
+            copy_out(r, tail, &h, sizeof(h));
+            if (h.size < sizeof(h)) break;
+            if (h.type == PERF_RECORD_SAMPLE && h.size <= sizeof(rec)) {
+                // u64 time, u32 tamaño, datos crudos del tracepoint
+                copy_out(r, tail, rec, h.size);
+                uint64_t t;
+                uint32_t raw_size;
+                std::memcpy(&t, rec + sizeof(h), 8);
+                std::memcpy(&raw_size, rec + sizeof(h) + 8, 4);
+                const char *raw = rec + sizeof(h) + 12;
+                if (sizeof(h) + 12 + raw_size <= h.size && raw_size >= 2) apply(raw, raw_size, static_cast<int64_t>(t));
+            } else if (h.type == PERF_RECORD_LOST) {
+                uint64_t n[2];
+                copy_out(r, tail + sizeof(h), n, sizeof(n));
+                lost_ += n[1];
+            }
+            tail += h.size;
+        }
+        __atomic_store_n(&r.meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    void apply(const char *raw, uint32_t size, int64_t t) {
+        uint16_t type;
+        std::memcpy(&type, raw, 2);
+        if (type != freq_.id && type != idle_.id) return;
+        const Event& ev = type == freq_.id ? freq_ : idle_;
+        if (ev.state_off + 4 > size || ev.cpu_off + 4 > size) return;
+        uint32_t state, cpu;
+        std::memcpy(&state, raw + ev.state_off, 4);
+        std::memcpy(&cpu, raw + ev.cpu_off, 4);
+        if (cpu >= mhz_.size()) {
+            mhz_.resize(cpu + 1, -1.0);
+            trans_.resize(cpu + 1);
+        }
+        if (type == freq_.id) {
+            mhz_[cpu] = state / 1000.0;    // kHz
+            ++trans_[cpu].changes;
+            trans_[cpu].last_ns = t;
+        } else if (state != 0xFFFFFFFFu) {  // (u32)-1 = salida de idle
+            ++trans_[cpu].idle;
+        }
+    }
+
+    std::string root_;
+    Event freq_, idle_;
+    std::vector<Ring> rings_;
+    size_t page_ = 4096;
+    std::vector<double> mhz_;
+    std::vector<CoreTransitions> trans_;
+    uint64_t lost_ = 0;
+};
+#endif
+
+// ---------------------- Fuentes de frecuencia ---------------------
+// Orden de prueba: el primero que abre. perf (cuesta un grupo de contadores
+// por CPU) y tracepoint (necesita tracefs y permisos de perf) no entran en
+// la prueba automática: solo por nombre.
+#ifdef _WIN32
+using FrequencyBackends = BackendSet<PowrProfFrequency>;
+#else
+using FrequencyBackends = BackendSet<MsrFrequency, SysfsFrequency, CpuinfoFrequency, PerfFrequency,
+                                     TracepointFrequency>;
+#endif
+
+template <class T, class = void> struct has_counters : std::false_type {};
+template <class T>
+struct has_counters<T, std::void_t<decltype(std::declval<const T&>().counters())>> : std::true_type {};
+template <class T, class = void> struct has_partial : std::false_type {};
+template <class T>
+struct has_partial<T, std::void_t<decltype(std::declval<T&>().sample(static_cast<const std::vector<uint8_t>*>(nullptr)))>>
+    : std::true_type {};
+template <class T, class = void> struct has_transitions : std::false_type {};
+template <class T>
+struct has_transitions<T, std::void_t<decltype(std::declval<const T&>().transitions())>> : std::true_type {};
+
+class FrequencySource {
+public:
+    bool open(const char *force = nullptr) { return backends_.open(force); }
+    bool empty() const { return backends_.empty(); }
+    const char *name() const { return backends_.name(); }
+
+    // MHz por CPU lógica (indexado por id); -1 = N/D. Vacío si no hay datos.
+    // due (--adaptive) pide releer solo algunos núcleos; el backend que no
+    // sabe hacerlo los relee todos.
+    const std::vector<double>& sample(const std::vector<uint8_t> *due = nullptr) {
+        const std::vector<double> *out = &empty_;
+        backends_.visit([&](auto& b) {
+            if constexpr (has_partial<std::decay_t<decltype(b)>>::value) out = &b.sample(due);
+            else out = &b.sample();
+        });
+        return *out;
+    }
+
+    // Contadores hardware de la última muestra; nullptr si el backend no los da.
+    const std::vector<CoreCounters> *counters() {
+        const std::vector<CoreCounters> *out = nullptr;
+        backends_.visit([&](auto& b) {
+            if constexpr (has_counters<std::decay_t<decltype(b)>>::value) out = &b.counters();
+        });
+        return out;
+    }
+
+    // Transiciones por núcleo (fuente tracepoint); nullptr si no las hay.
+    const std::vector<CoreTransitions> *transitions() {
+        const std::vector<CoreTransitions> *out = nullptr;
+        backends_.visit([&](auto& b) {
+            if constexpr (has_transitions<std::decay_t<decltype(b)>>::value) out = &b.transitions();
+        });
+        return out;
+    }
+
+private:
+    FrequencyBackends backends_;
+    std::vector<double> empty_;
+};
+
+// Compatibilidad: una muestra con una fuente compartida.
+std::vector<double> get_core_frequencies_mhz() {
+    static FrequencySource source;
+    static const bool opened = source.open();
+    (void)opened;
+    return source.sample();
+}
+
+// ---------------------- Temperatura y energía ---------------------
+// --thermal: temperatura de núcleo y de paquete (hwmon coretemp/k10temp o,
+// si no hay, thermal_zone x86_pkg_temp), potencia por paquete a partir de
+// los contadores RAPL de powercap y los contadores de throttling térmico de
+// cpuN/thermal_throttle. Como en SysfsFrequency, cada fichero se abre una
+// vez y cada muestra es un pread() por fd; el resultado va por id de CPU
+// para pintarse en la misma fila [CPU i] que la frecuencia.
+enum : uint8_t { kThrottleCore = 1, kThrottlePkg = 2 };  // CoreThermal::throttle
+
+struct CoreThermal {
+    float temp_c = -1;      // del núcleo; -1 = N/D
+    float pkg_temp_c = -1;  // del paquete
+    float pkg_watts = -1;   // RAPL del paquete
+    int16_t pkg = -1;       // physical_package_id
+    uint8_t throttle = 0;   // kThrottle* si el contador subió en el intervalo
+};
+
+#ifndef _WIN32
+class ThermalSampler {
+public:
+    explicit ThermalSampler(std::string sys = "/sys") : sys_(std::move(sys)) {}
+    ~ThermalSampler() { close_all(); }
+    ThermalSampler(const ThermalSampler&) = delete;
+    ThermalSampler& operator=(const ThermalSampler&) = delete;
+
+    // false si no hay ninguna fuente (ni sensores, ni RAPL, ni contadores).
+    bool open() {
+        close_all();
+        map_cpus();
+        open_hwmon();
+        open_thermal_zones();
+        open_rapl();
+        int nfds = 0;
+        for (const Core& c : cores_) nfds += (c.temp_fd >= 0) + (c.thr_fd >= 0);
+        for (const Pkg& p : pkgs_) nfds += (p.temp_fd >= 0) + (p.energy_fd >= 0) + (p.thr_fd >= 0);
+        return active_ = nfds > 0;
+    }
+    bool active() const { return active_; }
+
+    const std::vector<CoreThermal>& sample() {
+        const int64_t now = monotonic_ns();
+        const double dt = last_ns_ ? (now - last_ns_) / 1e9 : 0.0;
+        last_ns_ = now;
+        unsigned long long v;
+        for (Core& c : cores_) {
+            c.temp = c.temp_fd >= 0 && read_ull(c.temp_fd, v) ? v / 1000.0f : -1.0f;
+            c.throttled = c.thr_fd >= 0 && read_ull(c.thr_fd, v) && bump(c.thr, v);
+        }
+        for (Pkg& p : pkgs_) {
+            p.temp = p.temp_fd >= 0 && read_ull(p.temp_fd, v) ? v / 1000.0f : -1.0f;
+            p.throttled = p.thr_fd >= 0 && read_ull(p.thr_fd, v) && bump(p.thr, v);
+            p.watts = -1;
+            if (p.energy_fd >= 0 && read_ull(p.energy_fd, v)) {
+                // energy_uj da la vuelta en max_energy_range_uj; si no se
+                // conoce el rango (o no cuadra), ese tick queda en N/D
+                const bool wrapped = v < p.last_uj;
+                if (p.have_uj && dt > 0 && (!wrapped || p.max_uj > p.last_uj)) {
+                    const unsigned long long d = wrapped ? v + p.max_uj - p.last_uj : v - p.last_uj;
+                    p.watts = static_cast<float>(d / 1e6 / dt);
+                }
+                p.last_uj = v;
+                p.have_uj = true;
+            }
+        }
+        for (size_t i = 0; i < out_.size(); ++i) {
+            CoreThermal& t = out_[i];
+            t = CoreThermal{};
+            if (cpu_core_[i] >= 0) {
+                const Core& c = cores_[cpu_core_[i]];
+                t.temp_c = c.temp;
+                if (c.throttled) t.throttle |= kThrottleCore;
+            }
+            if (cpu_pkg_[i] >= 0) {
+                const Pkg& p = pkgs_[cpu_pkg_[i]];
+                t.pkg = static_cast<int16_t>(p.id);
+                t.pkg_temp_c = p.temp;
+                t.pkg_watts = p.watts;
+                if (p.throttled) t.throttle |= kThrottlePkg;
+            }
+        }
+        return out_;
+    }
+
+private:
+    struct Core { int pkg, id; int temp_fd = -1, thr_fd = -1; unsigned long long thr = ~0ull; float temp = -1; bool throttled = false; };
+    struct Pkg {
+        int id;
+        int temp_fd = -1, energy_fd = -1, thr_fd = -1;
+        unsigned long long thr = ~0ull, max_uj = 0, last_uj = 0;
+        bool have_uj = false, throttled = false;
+        float temp = -1, watts = -1;
+    };
+
+    static bool read_ull(int fd, unsigned long long& v) {
+        char buf[32];
+        const ssize_t n = ::pread(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        v = parse_ull(buf, buf + n);
+        return true;
+    }
+    // true si el contador subió desde la lectura anterior (la primera no cuenta)
+    static bool bump(unsigned long long& last, unsigned long long v) {
+        const bool up = last != ~0ull && v > last;
+        last = v;
+        return up;
+    }
+    static int open_ro(const std::string& path) { return ::open(path.c_str(), O_RDONLY | O_CLOEXEC); }
+    static std::string read_line(const std::string& path) {
+        char buf[128];
+        ssize_t n = read_small_file(path.c_str(), buf, sizeof(buf));
+        if (n <= 0) return std::string();
+        while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' ')) --n;
+        return std::string(buf, n);
+    }
+    // Entradas de dir que empiezan por prefix, ordenadas por el número que sigue.
+    static std::vector<std::string> list_dir(const std::string& dir, const char *prefix) {
+        std::vector<std::pair<long, std::string>> v;
+        if (DIR *d = opendir(dir.c_str())) {
+            const size_t k = std::strlen(prefix);
+            while (dirent *e = readdir(d))
+                if (std::strncmp(e->d_name, prefix, k) == 0)
+                    v.emplace_back(std::atol(e->d_name + k), e->d_name);
+            closedir(d);
+        }
+        std::sort(v.begin(), v.end());
+        std::vector<std::string> out;
+        for (auto& x : v) out.push_back(std::move(x.second));
+        return out;
+    }
+
+    int core_slot(int pkg, int id) {
+        for (size_t i = 0; i < cores_.size(); ++i)
+            if (cores_[i].pkg == pkg && cores_[i].id == id) return static_cast<int>(i);
+        cores_.push_back(Core{ pkg, id });
+        return static_cast<int>(cores_.size() - 1);
+    }
+    int pkg_slot(int id) {
+        for (size_t i = 0; i < pkgs_.size(); ++i)
+            if (pkgs_[i].id == id) return static_cast<int>(i);
+        pkgs_.push_back(Pkg{ id });
+        return static_cast<int>(pkgs_.size() - 1);
+    }
+
+    // CPU -> (paquete, núcleo) y un contador de throttling por núcleo y por paquete.
+    void map_cpus() {
+        const CpuSet& set = CpuSet::at(sys_ + "/devices/system/cpu");
+        const std::vector<int>& ids = set.present();
+        const size_t n = ids.empty() ? 0 : ids.back() + 1;
+        cpu_core_.assign(n, -1);
+        cpu_pkg_.assign(n, -1);
+        out_.assign(n, CoreThermal{});
+        for (int c : ids) {
+            const std::string dir = set.root() + "/cpu" + std::to_string(c);
+            const int pkg = static_cast<int>(read_int_file(dir + "/topology/physical_package_id", 0));
+            const int core = static_cast<int>(read_int_file(dir + "/topology/core_id", c));
+            cpu_core_[c] = core_slot(pkg, core);
+            cpu_pkg_[c] = pkg_slot(pkg);
+            Core& cs = cores_[cpu_core_[c]];
+            if (cs.thr_fd < 0) cs.thr_fd = open_ro(dir + "/thermal_throttle/core_throttle_count");
+            Pkg& ps = pkgs_[cpu_pkg_[c]];
+            if (ps.thr_fd < 0) ps.thr_fd = open_ro(dir + "/thermal_throttle/package_throttle_count");
+        }
+    }
+
+    // Sensores tempN que tienen tempN_label, en orden de N: (etiqueta,
+    // ruta de tempN_input). coretemp numera core_id + 2 y core_id tiene
+    // huecos en muchos Xeon, así que no se sondean índices seguidos.
+    static std::vector<std::pair<std::string, std::string>> temp_labels(const std::string& dir) {
+        std::vector<std::pair<std::string, std::string>> out;
+        for (const std::string& e : list_dir(dir, "temp")) {
+            if (e.size() <= 6 || e.compare(e.size() - 6, 6, "_label") != 0) continue;
+            const size_t k = e.size() - 6;
+            std::string label = read_line(dir + "/" + e);
+            if (!label.empty()) out.emplace_back(std::move(label), dir + "/" + e.substr(0, k) + "_input");
+        }
+        return out;
+    }
+
+    // coretemp: un hwmon por paquete con "Package id P" y "Core K".
+    // k10temp/zenpower: un hwmon por paquete (en orden) con Tdie o Tctl.
+    void open_hwmon() {
+        const std::string base = sys_ + "/class/hwmon";
+        size_t amd = 0;
+        for (const std::string& h : list_dir(base, "hwmon")) {
+            const std::string dir = base + "/" + h;
+            const std::string name = read_line(dir + "/name");
+            if (name == "coretemp") {
+                int pkg = -1;
+                std::vector<std::pair<int, std::string>> cores;
+                for (const auto& t : temp_labels(dir)) {
+                    const std::string& label = t.first;
+                    const std::string& input = t.second;
+                    if (label.rfind("Package id ", 0) == 0) {
+                        pkg = std::atoi(label.c_str() + 11);
+                        Pkg& p = pkgs_[pkg_slot(pkg)];
+                        if (p.temp_fd < 0) p.temp_fd = open_ro(input);
+                    } else if (label.rfind("Core ", 0) == 0) {
+                        cores.emplace_back(std::atoi(label.c_str() + 5), input);
+                    }
+                }
+                for (auto& c : cores)
+                    for (Core& cs : cores_)
+                        if (cs.pkg == std::max(pkg, 0) && cs.id == c.first && cs.temp_fd < 0)
+                            cs.temp_fd = open_ro(c.second);
+            } else if (name == "k10temp" || name == "zenpower") {
+                if (amd >= pkgs_.size()) continue;
+                std::string input;
+                for (const auto& t : temp_labels(dir))
+                    if (t.first == "Tdie" || (t.first == "Tctl" && input.empty())) input = t.second;
+                Pkg& p = pkgs_[amd++];
+                if (!input.empty() && p.temp_fd < 0) p.temp_fd = open_ro(input);
+            }
+        }
+    }
+
+    // Sin hwmon: las zonas x86_pkg_temp, una por paquete en orden.
+    void open_thermal_zones() {
+        const std::string base = sys_ + "/class/thermal";
+        size_t k = 0;
+        for (const std::string& z : list_dir(base, "thermal_zone")) {
+            if (read_line(base + "/" + z + "/type") != "x86_pkg_temp") continue;
+            if (k >= pkgs_.size()) break;
+            Pkg& p = pkgs_[k++];
+            if (p.temp_fd < 0) p.temp_fd = open_ro(base + "/" + z + "/temp");
+        }
+    }
+
+    // powercap: intel-rapl:N con name "package-P" (también en AMD recientes).
+    void open_rapl() {
+        const std::string base = sys_ + "/class/powercap";
+        for (const std::string& z : list_dir(base, "intel-rapl:")) {
+            if (z.find(':', 11) != std::string::npos) continue;   // subzonas core/uncore/dram
+            const std::string dir = base + "/" + z;
+            const std::string name = read_line(dir + "/name");
+            if (name.rfind("package-", 0) != 0) continue;
+            Pkg& p = pkgs_[pkg_slot(std::atoi(name.c_str() + 8))];
+            if (p.energy_fd >= 0) continue;
+            p.energy_fd = open_ro(dir + "/energy_uj");
+            p.max_uj = static_cast<unsigned long long>(read_int_file(dir + "/max_energy_range_uj", 0));
+        }
+    }
+
+    void close_all() {
+        for (Core& c : cores_) { if (c.temp_fd >= 0) ::close(c.temp_fd); if (c.thr_fd >= 0) ::close(c.thr_fd); }
+        for (Pkg& p : pkgs_) {
+            if (p.temp_fd >= 0) ::close(p.temp_fd);
+            if (p.energy_fd >= 0) ::close(p.energy_fd);
+            if (p.thr_fd >= 0) ::close(p.thr_fd);
+        }
+        cores_.clear();
+        pkgs_.clear();
+        active_ = false;
+    }
+
+    std::string sys_;
+    std::vector<Core> cores_;
+    std::vector<Pkg> pkgs_;
+    std::vector<int> cpu_core_, cpu_pkg_;   // índices en cores_/pkgs_; -1 = sin datos
+    std::vector<CoreThermal> out_;
+    int64_t last_ns_ = 0;
+    bool active_ = false;
+};
+#else
+// Windows solo expone la temperatura por WMI (MSAcpi_ThermalZoneTemperature,
+// y no en todos los equipos) y RAPL no sin un driver: --thermal no hace nada.
+class ThermalSampler {
+public:
+    bool open() { return false; }
+    bool active() const { return false; }
+    const std::vector<CoreThermal>& sample() { return out_; }
+
+private:
+    std::vector<CoreThermal> out_;
+};
+#endif
+
+// ----------------------- Lista de procesos ----------------------
+// ProcessTable mantiene la tabla entre ticks (clave = PID): solo lee el
+// nombre de los PIDs nuevos y descarta los que desaparecieron.
+#ifdef _WIN32
+using proc_id = DWORD;
+
+struct ProcInfo {
+    DWORD pid;
+    const char *name;                // internado en NameTable
+    ULONGLONG utime = 0, stime = 0;  // unidades de 100 ns (GetProcessTimes)
+    unsigned long long rss_kb = 0;   // working set
+    double cpu_pct = 0.0;            // entre las dos últimas muestras
+    bool sampled = false;            // ya hay una muestra previa de tiempos
+    uint8_t excluded = 0;            // kExclCgroup | kExclName (ProcQuery)
+    int cpu = -1;                    // sin equivalente barato: N/D
+    unsigned long long vcsw = 0, ivcsw = 0;
+    float vcsw_s = -1, ivcsw_s = -1;
+};
+#else
+using proc_id = pid_t;
+
+struct ProcInfo {
+    pid_t pid;                                // TID en las tablas de hilos (--tasks)
+    const char *name;                         // internado en NameTable
+    unsigned long long utime = 0, stime = 0;  // ticks de reloj (USER_HZ)
+    unsigned long long rss_kb = 0;
+    double cpu_pct = 0.0;                     // entre las dos últimas muestras
+    bool sampled = false;                     // ya hay una muestra previa de ticks
+    uint8_t excluded = 0;                     // kExclCgroup | kExclName (ProcQuery)
+    int cpu = -1;                             // CPU de la última ejecución (stat, processor)
+    unsigned long long vcsw = 0, ivcsw = 0;   // cambios de contexto (solo hilos de --tasks)
+    float vcsw_s = -1, ivcsw_s = -1;          // por segundo; -1 = N/D
+};
+#endif
+
+// Consulta sobre la tabla (--top, --sort, --filter, --cgroup). Se aplica
+// durante el recorrido: un PID que no pasa el filtro queda en la tabla
+// marcado como excluido (para no volver a evaluarlo en cada tick) y no se
+// leen sus stat; fuera del cgroup ni siquiera se lee su nombre.
+enum SortKey { kSortCpu, kSortRss, kSortPid, kSortName };
+static const char *const kSortNames[] = { "cpu", "rss", "pid", "name" };
+
+enum : uint8_t { kExclCgroup = 1, kExclName = 2 };  // ProcInfo::excluded
+
+struct ProcQuery {
+    size_t top = 25;
+    int sort = kSortCpu;
+    std::string cgroup;             // prefijo de ruta; vacío = todos
+
+    // "name=~REGEX" o "name=EXACTO"
+    bool parse_filter(const std::string& spec) {
+        if (spec.rfind("name=~", 0) == 0) {
+            try {
+                name_re_ = std::regex(spec.substr(6), std::regex::ECMAScript | std::regex::optimize);
+            } catch (const std::regex_error&) {
+                return false;
+            }
+            name_mode_ = kRegex;
+            return true;
+        }
+        if (spec.rfind("name=", 0) == 0) {
+            name_exact_ = spec.substr(5);
+            name_mode_ = kExact;
+            return true;
+        }
+        return false;
+    }
+
+    bool match_name(const char *name) const {
+        switch (name_mode_) {
+        case kExact: return name_exact_ == name;
+        case kRegex: return std::regex_search(name, name_re_);
+        default: return true;
+        }
+    }
+
+    // a va antes que b en el orden pedido (desempate por PID).
+    bool before(const ProcInfo& a, const ProcInfo& b) const {
+        switch (sort) {
+        case kSortCpu: if (a.cpu_pct != b.cpu_pct) return a.cpu_pct > b.cpu_pct; break;
+        case kSortRss: if (a.rss_kb != b.rss_kb) return a.rss_kb > b.rss_kb; break;
+        case kSortName: if (int c = std::strcmp(a.name, b.name)) return c < 0; break;
+        default: break;
+        }
+        return a.pid < b.pid;
+    }
+
+private:
+    enum { kAny, kExact, kRegex } name_mode_ = kAny;
+    std::string name_exact_;
+    std::regex name_re_;
+};
+
+static int parse_sort(const std::string& s) {
+    for (int i = 0; i < 4; ++i) if (s == kSortNames[i]) return i;
+    return -1;
+}
+
+// Nombres internados: los de procesos se repiten muchísimo (kworker, nginx,
+// java...), así que cada nombre distinto se guarda una sola vez, ya
+// terminado en '\0', en bloques de 64 KB que no se mueven; los ProcInfo
+// apuntan ahí. Solo reserva memoria con nombres nuevos.
+class NameTable {
+public:
+    const char *intern(const char *s, size_t n) {
+        auto it = index_.find(std::string_view(s, n));
+        if (it != index_.end()) return it->data();
+        char *p = alloc(n + 1);
+        std::memcpy(p, s, n);
+        p[n] = '\0';
+        index_.emplace(p, n);
+        return p;
+    }
+    size_t bytes() const { return blocks_.size() * kBlock; }
+    size_t distinct() const { return index_.size(); }
+
+private:
+    static constexpr size_t kBlock = 64 * 1024;
+
+    char *alloc(size_t n) {
+        if (blocks_.empty() || used_ + n > kBlock) {
+            blocks_.emplace_back(new char[kBlock]);
+            used_ = 0;
+        }
+        char *p = blocks_.back().get() + used_;
+        used_ += n;
+        return p;
+    }
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    size_t used_ = 0;
+    std::unordered_set<std::string_view> index_;
+};
+
+// Tabla de procesos plana y ordenada por PID: find() es una búsqueda
+// binaria y un recorrido es lineal sobre memoria contigua. Altas y bajas se
+// acumulan durante el tick y commit() las funde en una sola pasada sobre un
+// segundo vector; los tres vectores se reutilizan, así que en régimen
+// estable no hay reservas. Los punteros a entradas valen hasta el commit().
+class ProcList {
+public:
+    size_t size() const { return items_.size(); }
+    ProcInfo& operator[](size_t i) { return items_[i]; }
+    const ProcInfo& operator[](size_t i) const { return items_[i]; }
+    std::vector<ProcInfo>::const_iterator begin() const { return items_.begin(); }
+    std::vector<ProcInfo>::const_iterator end() const { return items_.end(); }
+
+    ProcInfo *find(proc_id pid) {
+        auto it = std::lower_bound(items_.begin(), items_.end(), pid,
+                                   [](const ProcInfo& p, proc_id v) { return p.pid < v; });
+        return it != items_.end() && it->pid == pid ? &*it : nullptr;
+    }
+
+    // Proceso nuevo; si el PID ya estaba (reutilizado), lo sustituye.
+    void add(proc_id pid, const char *name, uint8_t excluded = 0) {
+        add_.push_back(ProcInfo{ pid, name });
+        add_.back().excluded = excluded;
+    }
+    // Nombre nuevo (exec, comm) conservando los contadores; name_excluded
+    // es el resultado del filtro de nombre para el nombre nuevo.
+    void rename(proc_id pid, const char *name, bool name_excluded = false) {
+        if (ProcInfo *p = find(pid)) {
+            p->name = name;
+            p->excluded = static_cast<uint8_t>((p->excluded & ~kExclName) | (name_excluded ? kExclName : 0));
+        } else {
+            add(pid, name, name_excluded ? kExclName : 0);
+        }
+    }
+    // Si el alta aún no se aplicó (fork y exit en el mismo tick), se anula.
+    void remove(proc_id pid) {
+        add_.erase(std::remove_if(add_.begin(), add_.end(), [&](const ProcInfo& p) { return p.pid == pid; }),
+                   add_.end());
+        del_.push_back(pid);
+    }
+
+    // Altas y bajas aplicadas desde el arranque (para --adaptive).
+    uint64_t changes() const { return changes_; }
+
+    void commit() {
+        if (add_.empty() && del_.empty()) return;
+        changes_ += add_.size() + del_.size();
+        auto by_pid = [](const ProcInfo& a, const ProcInfo& b) { return a.pid < b.pid; };
+        std::stable_sort(add_.begin(), add_.end(), by_pid);
+        std::sort(del_.begin(), del_.end());
+
+        spare_.clear();
+        size_t a = 0, d = 0;
+        for (const ProcInfo& p : items_) {
+            for (; a < add_.size() && add_[a].pid < p.pid; ++a) push_add(a);
+            while (d < del_.size() && del_[d] < p.pid) ++d;
+            if (a < add_.size() && add_[a].pid == p.pid) { push_add(a); ++a; }
+            else if (d >= del_.size() || del_[d] != p.pid) spare_.push_back(p);
+        }
+        for (; a < add_.size(); ++a) push_add(a);
+        items_.swap(spare_);
+        add_.clear();
+        del_.clear();
+    }
+
+private:
+    // De varias altas del mismo PID vale la última.
+    void push_add(size_t& a) {
+        while (a + 1 < add_.size() && add_[a + 1].pid == add_[a].pid) ++a;
+        spare_.push_back(add_[a]);
+    }
+
+    std::vector<ProcInfo> items_, spare_, add_;
+    std::vector<proc_id> del_;
+    uint64_t changes_ = 0;
+};
+
+// Con muchos nombres muertos (p. ej. hilos con nombres únicos), rehace la
+// tabla solo con los vivos. Amortizado: hacen falta ~1000 nombres nuevos.
+static void compact_names(NameTable& names, ProcList& procs) {
+    if (names.distinct() <= 2 * procs.size() + 1024) return;
+    NameTable fresh;
+    for (size_t i = 0; i < procs.size(); ++i) procs[i].name = fresh.intern(procs[i].name, std::strlen(procs[i].name));
+    names = std::move(fresh);
+}
+
+#ifdef _WIN32
+// Toolhelp32: una instantánea por tick; solo se crean entradas para los
+// PIDs nuevos y se descartan los que desaparecieron.
+class Toolhelp32Processes {
+public:
+    static constexpr const char *kName = "toolhelp32";
+    static constexpr bool kProbe = true;
+
+    bool open(const std::string&) { return true; }
+
+    void update(ProcList& procs, NameTable& names, const ProcQuery& query) {
+        HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+        if (snap == INVALID_HANDLE_VALUE) return;
+
+        seen_.clear();
+        PROCESSENTRY32 pe;
+        pe.dwSize = sizeof(pe);
+        if (Process32First(snap, &pe)) {
+            do {
+                seen_.push_back(pe.th32ProcessID);
+                if (!procs.find(pe.th32ProcessID)) {
+                    const char *name = names.intern(pe.szExeFile, std::strlen(pe.szExeFile));
+                    procs.add(pe.th32ProcessID, name, query.match_name(name) ? 0 : kExclName);
+                }
+            } while (Process32Next(snap, &pe));
+        }
+        CloseHandle(snap);
+
+        std::sort(seen_.begin(), seen_.end());
+        for (const ProcInfo& p : procs)
+            if (!std::binary_search(seen_.begin(), seen_.end(), p.pid)) procs.remove(p.pid);
+        procs.commit();
+    }
+
+private:
+    std::vector<DWORD> seen_;
+};
+
+using ProcessBackends = BackendSet<Toolhelp32Processes>;
+
+class ProcessTable {
+public:
+    // force: "toolhelp32" o nullptr. refresh() abre solo si no se llamó.
+    bool open(const char *force = nullptr) {
+        opened_ = true;
+        return backends_.open(force, std::string());
+    }
+    const char *source_name() const { return backends_.name(); }
+
+    // Workers para leer tiempos y memoria (por defecto 1: sin hilos).
+    void set_threads(unsigned n) { pool_.start(n); }
+    // Filtros de la consulta (en Windows no hay cgroups); antes del primer refresh().
+    void set_query(const ProcQuery& q) { query_ = q; }
+    const ProcQuery& query() const { return query_; }
+    // --tasks: sin implementar en Windows (los PIDs se aceptan, sin hilos).
+    void set_tasks(const std::vector<proc_id>& pids) { task_pids_ = pids; }
+    size_t tasks() const { return task_pids_.size(); }
+    proc_id task_pid(size_t i) const { return task_pids_[i]; }
+    const ProcList& task_threads(size_t) const { return no_threads_; }
+    void refresh_tasks() {}
+
+    void refresh() {
+        if (!opened_) open();
+        backends_.visit([&](auto& b) { b.update(procs_, names_, query_); });
+        compact_names(names_, procs_);
+        update_stats();
+    }
+
+    const ProcList& entries() const { return procs_; }
+    uint64_t changes() const { return procs_.changes(); }
+
+private:
+    // CPU y memoria por proceso; CPU% = delta(kernel+user) / delta(tiempo real).
+    // Cada worker escribe solo en las entradas de sus trozos.
+    void update_stats() {
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - last_).count();
+        bool have_prev = last_.time_since_epoch().count() != 0;
+        last_ = now;
+
+        pool_.parallel_for(procs_.size(), 256, [&](unsigned, size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i)
+                if (!procs_[i].excluded) update_one(procs_[i], have_prev, dt);
+        });
+    }
+
+    static void update_one(ProcInfo& p, bool have_prev, double dt) {
+        HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, p.pid);
+        if (!h) return;  // protegido o ya terminó
+        FILETIME c, e, k, u;
+        if (GetProcessTimes(h, &c, &e, &k, &u)) {
+            ULONGLONG kt = (ULONGLONG(k.dwHighDateTime) << 32) | k.dwLowDateTime;
+            ULONGLONG ut = (ULONGLONG(u.dwHighDateTime) << 32) | u.dwLowDateTime;
+            ULONGLONG prev = p.utime + p.stime;
+            p.cpu_pct = (have_prev && p.sampled && dt > 0 && kt + ut >= prev)
+                ? (double(kt + ut - prev) / 1e7) / dt * 100.0 : 0.0;
+            p.utime = ut;
+            p.stime = kt;
+            p.sampled = true;
+        }
+        PROCESS_MEMORY_COUNTERS pmc;
+        if (GetProcessMemoryInfo(h, &pmc, sizeof(pmc))) p.rss_kb = pmc.WorkingSetSize / 1024;
+        CloseHandle(h);
+    }
+
+    ProcessBackends backends_;
+    bool opened_ = false;
+    NameTable names_;
+    ProcList procs_;
+    ProcQuery query_;
+    WorkPool pool_;
+    std::chrono::steady_clock::time_point last_{};
+    std::vector<proc_id> task_pids_;
+    ProcList no_threads_;
+};
+#else
+// Campos de /proc/<pid>/stat que interesan. El comm va entre paréntesis y
+// puede contener espacios o ')', así que se busca el último ')'.
+struct ProcStat { unsigned long long utime = 0, stime = 0, rss_pages = 0; int processor = -1; };
+
+static bool parse_proc_stat(const char *p, const char *end, ProcStat& st) {
+    const char *rp = end;
+    while (rp > p && *(rp - 1) != ')') --rp;
+    if (rp == p) return false;
+    p = rp;
+
+    int field = 2;  // el campo 2 es (comm)
+    while (p < end) {
+        while (p < end && *p == ' ') ++p;
+        if (p >= end || *p == '\n') break;   // línea corta: processor queda en -1
+        const char *s = p;
+        while (p < end && *p != ' ' && *p != '\n') ++p;
+        switch (++field) {
+        case 14: st.utime = parse_ull(s, p); break;
+        case 15: st.stime = parse_ull(s, p); break;
+        case 24: st.rss_pages = parse_ull(s, p); break;
+        case 39: st.processor = static_cast<int>(parse_ull(s, p)); return true;
+        }
+    }
+    return field >= 24;
+}
+
+// voluntary_ctxt_switches y nonvoluntary_ctxt_switches de /status.
+static bool parse_ctxt_switches(const char *p, const char *end, unsigned long long& vol, unsigned long long& invol) {
+    const std::string_view buf(p, end - p);
+    const size_t v = buf.find("\nvoluntary_ctxt_switches:");
+    const size_t iv = buf.find("\nnonvoluntary_ctxt_switches:");
+    if (v == std::string_view::npos || iv == std::string_view::npos) return false;
+    auto number = [&](size_t at) {
+        const char *s = p + at;
+        while (s < end && (*s == ' ' || *s == '\t')) ++s;
+        const char *e = s;
+        while (e < end && *e >= '0' && *e <= '9') ++e;
+        return parse_ull(s, e);
+    };
+    vol = number(v + 25);
+    invol = number(iv + 28);
+    return true;
+}
+
+
+// Nombre del proceso en out (con '\0'): <root>/<pid>/comm y, si falla,
+// "Name:" de /status (su primera línea). Rutas y lecturas en buffers de
+// pila. Devuelve la longitud; 0 si no se pudo leer.
+static size_t read_proc_name(const std::string& root, pid_t pid, char *out, size_t cap) {
+    char path[128], buf[256];
+    std::snprintf(path, sizeof(path), "%s/%d/comm", root.c_str(), static_cast<int>(pid));
+    ssize_t n = read_small_file(path, buf, sizeof(buf));
+    const char *s = buf;
+    if (n <= 0) {
+        std::snprintf(path, sizeof(path), "%s/%d/status", root.c_str(), static_cast<int>(pid));
+        n = read_small_file(path, buf, sizeof(buf));
+        if (n < 5 || std::memcmp(buf, "Name:", 5) != 0) return 0;
+        for (s = buf + 5; s < buf + n && (*s == ' ' || *s == '\t'); ++s) {}
+    }
+    const char *end = buf + n;
+    if (const char *eol = static_cast<const char*>(std::memchr(s, '\n', end - s))) end = eol;
+    const size_t len = std::min<size_t>(end - s, cap - 1);
+    std::memcpy(out, s, len);
+    out[len] = '\0';
+    return len;
+}
+
+// ¿Alguna línea de <root>/<pid>/cgroup ("id:controladores:/ruta") tiene la
+// ruta bajo prefix? Con cgroup v2 hay una sola línea, "0::/ruta".
+static bool in_cgroup(const std::string& root, pid_t pid, const std::string& prefix) {
+    char path[128], buf[4096];
+    std::snprintf(path, sizeof(path), "%s/%d/cgroup", root.c_str(), static_cast<int>(pid));
+    const ssize_t n = read_small_file(path, buf, sizeof(buf));
+    if (n <= 0) return false;
+    const char *p = buf, *end = buf + n;
+    while (p < end) {
+        const char *eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char *c1 = static_cast<const char*>(std::memchr(p, ':', eol - p));
+        const char *c2 = c1 ? static_cast<const char*>(std::memchr(c1 + 1, ':', eol - c1 - 1)) : nullptr;
+        if (c2) {
+            const char *r = c2 + 1;
+            const size_t len = eol - r, k = prefix.size();
+            // "/kubepods" vale para "/kubepods/x" pero no para "/kubepodsx"
+            if (len >= k && std::memcmp(r, prefix.data(), k) == 0 &&
+                (len == k || prefix.back() == '/' || r[k] == '/'))
+                return true;
+        }
+        p = eol + 1;
+    }
+    return false;
+}
+
+// Lecturas por lotes con io_uring (syscalls directas, sin liburing): cada
+// fichero es una cadena openat -> read -> close sobre un slot de fichero
+// fijo, y una ventana entera de cadenas va en un solo io_uring_enter. Las
+// rutas y los buffers son de la ventana y se reutilizan. Si el kernel no
+// tiene io_uring, está deshabilitado (io_uring_disabled, seccomp) o no
+// admite openat a slots fijos (< 5.15), open() falla y el llamador usa el
+// camino síncrono.
+#ifdef INEX_HAVE_URING
+class UringReader {
+public:
+    static constexpr size_t kPathCap = 128;
+
+    UringReader() = default;
+    ~UringReader() { close(); }
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+
+    bool available() const { return fd_ >= 0; }
+
+    // window: cadenas por envío; cap: bytes leídos por fichero.
+    bool open(unsigned window = 256, size_t cap = 1024) {
+        close();
+        io_uring_params p{};
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, window * 3, &p));
+        if (fd_ < 0) return false;
+        window_ = std::min(window, p.sq_entries / 3);
+        cap_ = cap;
+
+        sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+        sq_ptr_ = ::mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) { sq_ptr_ = nullptr; close(); return false; }
+        cq_ptr_ = single ? sq_ptr_
+                         : ::mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) { cq_ptr_ = nullptr; close(); return false; }
+        sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) { close(); return false; }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        char *sq = static_cast<char*>(sq_ptr_), *cq = static_cast<char*>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        // tabla de ficheros fijos vacía: un slot por cadena de la ventana
+        std::vector<int> slots(window_, -1);
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, slots.data(), window_) < 0) {
+            close();
+            return false;
+        }
+        paths_.resize(window_ * kPathCap);
+        bufs_.resize(window_ * cap_);
+        res_.resize(window_);
+
+        // prueba real: kernels sin openat a slot fijo fallan aquí
+        ssize_t got = -1;
+        read_all(1, [](size_t, char *path, size_t cap) { std::snprintf(path, cap, "/proc/self/stat"); },
+                 [&](size_t, const char *, ssize_t n) { got = n; });
+        if (got <= 0) { close(); return false; }
+        return true;
+    }
+
+    // Lee n ficheros: path(i, buf, cap) escribe la ruta i; done(i, data, len)
+    // recibe su contenido (len < 0: -errno). done va en orden por ventana.
+    // Si io_uring_enter falla, el ring se cierra para siempre (le quedan
+    // SQEs sin consumir y CQEs en camino que se mezclarían con el lote
+    // siguiente) y lo que falte se lee de forma síncrona.
+    template <class P, class D>
+    void read_all(size_t n, P&& path, D&& done) {
+        for (size_t base = 0; base < n; base += window_) {
+            const unsigned k = static_cast<unsigned>(std::min<size_t>(window_, n - base));
+            if (fd_ < 0) {
+                for (unsigned j = 0; j < k; ++j) {
+                    path(base + j, &paths_[j * kPathCap], kPathCap);
+                    read_sync(base + j, &paths_[j * kPathCap], done);
+                }
+                continue;
+            }
+            unsigned tail = *sq_tail_;
+            for (unsigned j = 0; j < k; ++j) {
+                char *pj = &paths_[j * kPathCap];
+                path(base + j, pj, kPathCap);
+                res_[j] = -ECANCELED;
+
+                io_uring_sqe *s = next_sqe(tail);
+                s->opcode = IORING_OP_OPENAT;
+                s->fd = AT_FDCWD;
+                s->addr = reinterpret_cast<uint64_t>(pj);
+                s->open_flags = O_RDONLY;
+                s->file_index = j + 1;              // 1-based; 0 = fd normal
+                s->flags = IOSQE_IO_LINK;
+                s->user_data = j * 4 + 0;
+
+                s = next_sqe(tail);
+                s->opcode = IORING_OP_READ;
+                s->fd = static_cast<int>(j);
+                s->addr = reinterpret_cast<uint64_t>(&bufs_[j * cap_]);
+                s->len = static_cast<uint32_t>(cap_);
+                s->off = 0;
+                // hardlink: una lectura corta no debe cancelar el close
+                s->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+                s->user_data = j * 4 + 1;
+
+                s = next_sqe(tail);
+                s->opcode = IORING_OP_CLOSE;
+                s->file_index = j + 1;
+                s->user_data = j * 4 + 2;
+            }
+            __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+            unsigned submit = k * 3, pending = k * 3;
+            while (pending > 0) {
+                long r = ::syscall(__NR_io_uring_enter, fd_, submit, pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (r < 0 && errno != EINTR) { close(); break; }
+                if (r > 0) submit -= std::min<unsigned>(submit, static_cast<unsigned>(r));
+                unsigned head = *cq_head_;
+                const unsigned ctail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+                for (; head != ctail && pending > 0; ++head, --pending) {
+                    const io_uring_cqe& c = cqes_[head & cq_mask_];
+                    if ((c.user_data & 3) == 1) res_[c.user_data >> 2] = c.res;
+                }
+                __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            }
+            for (unsigned j = 0; j < k; ++j) {
+                if (fd_ < 0 && res_[j] == -ECANCELED) read_sync(base + j, &paths_[j * kPathCap], done);
+                else done(base + j, &bufs_[j * cap_], static_cast<ssize_t>(res_[j]));
+            }
+        }
+    }
+
+private:
+    // Con el ring cerrado el kernel aún puede estar escribiendo en bufs_:
+    // las lecturas síncronas van a un buffer aparte.
+    template <class D>
+    void read_sync(size_t i, const char *path, D& done) {
+        sync_.resize(cap_);
+        const ssize_t n = read_small_file(path, sync_.data(), cap_);
+        done(i, sync_.data(), n >= 0 ? n : -static_cast<ssize_t>(errno));
+    }
+
+    io_uring_sqe *next_sqe(unsigned& tail) {
+        const unsigned idx = tail & sq_mask_;
+        io_uring_sqe *s = &sqes_[idx];
+        std::memset(s, 0, sizeof(*s));
+        sq_array_[idx] = idx;
+        ++tail;
+        return s;
+    }
+
+    void close() {
+        if (sqes_) ::munmap(sqes_, sqes_len_);
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_len_);
+        if (sq_ptr_) ::munmap(sq_ptr_, sq_len_);
+        if (fd_ >= 0) ::close(fd_);
+        sqes_ = nullptr;
+        sq_ptr_ = cq_ptr_ = nullptr;
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+    unsigned window_ = 0;
+    size_t cap_ = 0;
+    void *sq_ptr_ = nullptr, *cq_ptr_ = nullptr;
+    size_t sq_len_ = 0, cq_len_ = 0, sqes_len_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+    unsigned *sq_tail_ = nullptr, *sq_array_ = nullptr, *cq_head_ = nullptr, *cq_tail_ = nullptr;
+    unsigned sq_mask_ = 0, cq_mask_ = 0;
+    std::vector<char> paths_, bufs_, sync_;
+    std::vector<int> res_;
+};
+#else
+// Sin <linux/io_uring.h>: siempre el camino síncrono.
+class UringReader {
+public:
+    static constexpr size_t kPathCap = 128;
+    bool available() const { return false; }
+    bool open(unsigned = 256, size_t = 1024) { return false; }
+    template <class P, class D> void read_all(size_t, P&&, D&&) {}
+};
+#endif
+
+// Recorrido completo de <root>: merge contra la tabla (ambos en orden de
+// PID) y lectura de los nombres de los PIDs nuevos: con io_uring en lotes
+// desde este hilo; si no, en el WorkPool, cada worker en su propio arena de
+// registros fijos. Los arenas se internan y vuelcan a la tabla al final,
+// desde un solo hilo y sin locks.
+class ProcScanner {
+public:
+    ProcScanner(WorkPool& pool, UringReader& uring, NameTable& names, const ProcQuery& query)
+        : pool_(pool), uring_(uring), names_(names), query_(query) {}
+
+    const char *intern(const char *s, size_t n) { return names_.intern(s, n); }
+    bool name_excluded(const char *name) const { return !query_.match_name(name); }
+
+    // Alta de un PID nuevo según la consulta: fuera del cgroup ni se lee el nombre.
+    void admit(const std::string& root, pid_t pid, ProcList& procs) {
+        if (!query_.cgroup.empty() && !in_cgroup(root, pid, query_.cgroup)) {
+            procs.add(pid, "", kExclCgroup);
+            return;
+        }
+        if (const char *name = read_name(root, pid)) procs.add(pid, name, name_excluded(name) ? kExclName : 0);
+    }
+    // Nombre internado del PID; nullptr si ya no existe.
+    const char *read_name(const std::string& root, pid_t pid) {
+        char buf[sizeof(NameRec::name)];
+        const size_t n = read_proc_name(root, pid, buf, sizeof(buf));
+        return n ? names_.intern(buf, n) : nullptr;
+    }
+
+    void run(const std::string& root, ProcList& procs) {
+        procs.commit();
+        DIR *d = opendir(root.c_str());
+        if (!d) return;
+
+        seen_.clear();
+        struct dirent *de;
+        while ((de = readdir(d)) != nullptr) {
+            // directorios numéricos = PIDs
+            const char *n = de->d_name, *e = n;
+            while (*e >= '0' && *e <= '9') ++e;
+            if (e == n || *e != '\0') continue;
+            seen_.push_back(static_cast<pid_t>(parse_long(n, e)));
+        }
+        closedir(d);
+        std::sort(seen_.begin(), seen_.end());
+
+        fresh_.clear();
+        size_t i = 0;
+        for (pid_t pid : seen_) {
+            while (i < procs.size() && procs[i].pid < pid) procs.remove(procs[i++].pid);
+            if (i < procs.size() && procs[i].pid == pid) ++i;
+            else fresh_.push_back(pid);
+        }
+        while (i < procs.size()) procs.remove(procs[i++].pid);
+
+        if (!query_.cgroup.empty()) {
+            size_t keep = 0;
+            for (pid_t pid : fresh_) {
+                if (in_cgroup(root, pid, query_.cgroup)) fresh_[keep++] = pid;
+                else procs.add(pid, "", kExclCgroup);
+            }
+            fresh_.resize(keep);
+        }
+
+        if (uring_.available()) {
+            uring_.read_all(fresh_.size(), [&](size_t k, char *path, size_t cap) {
+                std::snprintf(path, cap, "%s/%d/comm", root.c_str(), static_cast<int>(fresh_[k]));
+            }, [&](size_t k, const char *data, ssize_t n) {
+                while (n > 0 && data[n - 1] == '\n') --n;
+                // sin comm (o vacío): el camino síncrono prueba /status
+                const char *name = n > 0 ? names_.intern(data, n) : read_name(root, fresh_[k]);
+                if (name) procs.add(fresh_[k], name, name_excluded(name) ? kExclName : 0);
+            });
+        } else {
+            arenas_.resize(pool_.size());
+            for (auto& a : arenas_) a.clear();
+            pool_.parallel_for(fresh_.size(), 64, [&](unsigned w, size_t b, size_t e) {
+                for (size_t k = b; k < e; ++k) {
+                    NameRec r;
+                    r.pid = fresh_[k];
+                    r.len = static_cast<uint8_t>(read_proc_name(root, r.pid, r.name, sizeof(r.name)));
+                    if (r.len) arenas_[w].push_back(r);
+                }
+            });
+            for (const auto& a : arenas_)
+                for (const NameRec& r : a) {
+                    const char *name = names_.intern(r.name, r.len);
+                    procs.add(r.pid, name, name_excluded(name) ? kExclName : 0);
+                }
+        }
+        procs.commit();
+    }
+
+private:
+    struct NameRec { pid_t pid; uint8_t len; char name[64]; };
+
+    WorkPool& pool_;
+    UringReader& uring_;
+    NameTable& names_;
+    const ProcQuery& query_;
+    std::vector<pid_t> seen_, fresh_;
+    std::vector<std::vector<NameRec>> arenas_;  // uno por worker
+};
+
+// procfs: recorre el directorio en cada tick.
+class ProcfsProcesses {
+public:
+    static constexpr const char *kName = "procfs";
+    static constexpr bool kProbe = true;
+
+    bool open(const std::string& root) {
+        root_ = root;
+        struct stat st;
+        return ::stat(root_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    void update(ProcList& procs, ProcScanner& scanner) { scanner.run(root_, procs); }
+
+private:
+    std::string root_;
+};
+
+// netlink: con privilegios (CAP_NET_ADMIN) se suscribe al proc connector y
+// aplica los eventos fork/exec/comm/exit: un tick sin cambios no toca /proc.
+// Si se pierden eventos (ENOBUFS) recorre /proc una vez; si el socket falla,
+// sigue recorriendo en cada tick.
+class NetlinkProcesses {
+public:
+    static constexpr const char *kName = "netlink";
+    static constexpr bool kProbe = true;
+
+    ~NetlinkProcesses() { if (nl_fd_ >= 0) ::close(nl_fd_); }
+    NetlinkProcesses() = default;
+    NetlinkProcesses(const NetlinkProcesses&) = delete;
+    NetlinkProcesses& operator=(const NetlinkProcesses&) = delete;
+
+    // Los eventos son del /proc del sistema: otra raíz no tiene sentido.
+    bool open(const std::string& root) {
+        root_ = root;
+        return root_ == "/proc" && subscribe();
+    }
+
+    void update(ProcList& procs, ProcScanner& scanner) {
+        if (nl_fd_ >= 0) drain_events(procs, scanner);
+        procs.commit();
+        if (need_scan_ || nl_fd_ < 0) {
+            need_scan_ = false;
+            scanner.run(root_, procs);
+        }
+    }
+
+private:
+    bool subscribe() {
+        int fd = ::socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (fd < 0) return false;
+
+        sockaddr_nl sa{};
+        sa.nl_family = AF_NETLINK;
+        sa.nl_groups = CN_IDX_PROC;
+        sa.nl_pid = 0;
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0) { ::close(fd); return false; }
+
+        alignas(nlmsghdr) char msg[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+        auto *h = reinterpret_cast<nlmsghdr*>(msg);
+        h->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+        h->nlmsg_type = NLMSG_DONE;
+        auto *cn = reinterpret_cast<cn_msg*>(NLMSG_DATA(h));
+        cn->id.idx = CN_IDX_PROC;
+        cn->id.val = CN_VAL_PROC;
+        cn->len = sizeof(proc_cn_mcast_op);
+        proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+        std::memcpy(cn->data, &op, sizeof(op));
+        if (::send(fd, msg, h->nlmsg_len, 0) < 0) { ::close(fd); return false; }
+        nl_fd_ = fd;
+        return true;
+    }
+
+    void drain_events(ProcList& procs, ProcScanner& scanner) {
+        alignas(nlmsghdr) char buf[8192];
+        for (;;) {
+            sockaddr_nl from{};
+            socklen_t fromlen = sizeof(from);
+            ssize_t n = ::recvfrom(nl_fd_, buf, sizeof(buf), 0,
+                                   reinterpret_cast<sockaddr*>(&from), &fromlen);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == ENOBUFS) { need_scan_ = true; continue; } // se perdieron eventos
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    ::close(nl_fd_); nl_fd_ = -1;
+                }
+                return;
+            }
+            if (from.nl_pid != 0) continue; // solo mensajes del kernel
+
+            int len = static_cast<int>(n);
+            for (auto *h = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+                if (h->nlmsg_type == NLMSG_ERROR || h->nlmsg_type == NLMSG_NOOP) continue;
+                auto *cn = reinterpret_cast<cn_msg*>(NLMSG_DATA(h));
+                if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+                apply(*reinterpret_cast<const proc_event*>(cn->data), procs, scanner);
+            }
+        }
+    }
+
+    void apply(const proc_event& ev, ProcList& procs, ProcScanner& scanner) {
+        switch (ev.what) {
+        case proc_event::PROC_EVENT_FORK:
+            // los hilos nuevos también generan fork; solo interesan procesos
+            if (ev.event_data.fork.child_pid == ev.event_data.fork.child_tgid)
+                scanner.admit(root_, ev.event_data.fork.child_tgid, procs);
+            break;
+        case proc_event::PROC_EVENT_EXEC: {
+            pid_t pid = ev.event_data.exec.process_tgid;
+            const ProcInfo *p = procs.find(pid);
+            if (p && (p->excluded & kExclCgroup)) break;  // el nombre no importa
+            if (const char *name = scanner.read_name(root_, pid))
+                procs.rename(pid, name, scanner.name_excluded(name)); // conserva los contadores
+            break;
+        }
+        case proc_event::PROC_EVENT_COMM:
+            if (ev.event_data.comm.process_pid == ev.event_data.comm.process_tgid) {
+                const char *c = ev.event_data.comm.comm;
+                const char *name = scanner.intern(c, strnlen(c, sizeof(ev.event_data.comm.comm)));
+                procs.rename(ev.event_data.comm.process_tgid, name, scanner.name_excluded(name));
+            }
+            break;
+        case proc_event::PROC_EVENT_EXIT:
+            if (ev.event_data.exit.process_pid == ev.event_data.exit.process_tgid)
+                procs.remove(ev.event_data.exit.process_tgid);
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::string root_;
+    int nl_fd_ = -1;
+    bool need_scan_ = true;
+};
+
+using ProcessBackends = BackendSet<NetlinkProcesses, ProcfsProcesses>;
+
+class ProcessTable {
+public:
+    explicit ProcessTable(std::string root = "/proc") : root_(std::move(root)) {}
+
+    // force: "netlink", "procfs" o nullptr. refresh() abre solo si no se llamó.
+    bool open(const char *force = nullptr) {
+        opened_ = true;
+        if (want_uring_ && !uring_.available()) uring_.open();
+        return backends_.open(force, root_);
+    }
+    const char *source_name() const { return backends_.name(); }
+
+    // io_uring para las lecturas por PID si el kernel lo permite (por
+    // defecto sí); llamar antes de open().
+    void set_uring(bool on) { want_uring_ = on; }
+    bool uring() const { return uring_.available(); }
+
+    // Workers para el recorrido de /proc y los stat (por defecto 1: sin hilos).
+    void set_threads(unsigned n) { pool_.start(n); }
+    // Filtros de la consulta; llamar antes del primer refresh().
+    void set_query(const ProcQuery& q) { query_ = q; }
+    const ProcQuery& query() const { return query_; }
+
+    // --tasks: PIDs cuyos hilos se siguen. Los que ya estaban conservan su
+    // tabla de hilos y sus contadores.
+    void set_tasks(const std::vector<proc_id>& pids) {
+        std::vector<std::unique_ptr<TaskGroup>> next;
+        for (proc_id pid : pids) {
+            auto it = std::find_if(tasks_.begin(), tasks_.end(),
+                                   [&](const std::unique_ptr<TaskGroup>& t) { return t && t->pid == pid; });
+            if (it != tasks_.end()) next.push_back(std::move(*it));
+            else next.emplace_back(new TaskGroup(pid, root_, pool_, uring_));
+        }
+        tasks_.swap(next);
+    }
+    size_t tasks() const { return tasks_.size(); }
+    proc_id task_pid(size_t i) const { return tasks_[i]->pid; }
+    // Hilos del PID i-ésimo por TID; pid de cada entrada = TID.
+    const ProcList& task_threads(size_t i) const { return tasks_[i]->threads; }
+
+    void refresh() {
+        if (!opened_) open();
+        backends_.visit([&](auto& b) { b.update(procs_, scanner_); });
+        compact_names(names_, procs_);
+        update_stats();
+        refresh_tasks();
+    }
+    // Solo los hilos de --tasks, sin recorrer /proc.
+    void refresh_tasks() { for (auto& t : tasks_) update_task(*t); }
+
+    const ProcList& entries() const { return procs_; }
+    uint64_t changes() const { return procs_.changes(); }
+
+private:
+    // utime/stime/RSS de cada proceso; CPU% = delta de ticks / delta real.
+    // Cada worker escribe solo en las entradas de sus trozos.
+    void update_stats() {
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - last_).count();
+        bool have_prev = last_.time_since_epoch().count() != 0;
+        last_ = now;
+
+        // los excluidos por la consulta no se leen
+        rows_.clear();
+        for (size_t i = 0; i < procs_.size(); ++i)
+            if (!procs_[i].excluded) rows_.push_back(static_cast<uint32_t>(i));
+
+        if (uring_.available()) {
+            uring_.read_all(rows_.size(), [&](size_t i, char *path, size_t cap) {
+                std::snprintf(path, cap, "%s/%d/stat", root_.c_str(), static_cast<int>(procs_[rows_[i]].pid));
+            }, [&](size_t i, const char *data, ssize_t n) { apply_stat(procs_[rows_[i]], data, n, have_prev, dt); });
+            return;
+        }
+        pool_.parallel_for(rows_.size(), 256, [&](unsigned, size_t b, size_t e) {
+            char path[128];
+            char buf[1024];
+            for (size_t i = b; i < e; ++i) {
+                ProcInfo& p = procs_[rows_[i]];
+                std::snprintf(path, sizeof(path), "%s/%d/stat", root_.c_str(), static_cast<int>(p.pid));
+                apply_stat(p, buf, read_small_file(path, buf, sizeof(buf)), have_prev, dt);
+            }
+        });
+    }
+
+    // Hilos de un PID de --tasks: el mismo ProcScanner que la tabla de
+    // procesos, sobre <root>/<pid>/task (los TID tienen allí comm, stat y
+    // status como los PID en /proc), así que solo se leen los nombres de
+    // hilos nuevos. Por hilo, stat (CPU%, CPU actual) y status (cambios de
+    // contexto). Son pocos PIDs: lecturas síncronas.
+    struct TaskGroup {
+        TaskGroup(pid_t p, const std::string& proc_root, WorkPool& pool, UringReader& uring)
+            : pid(p), root(proc_root + "/" + std::to_string(p) + "/task"), scanner(pool, uring, names, query) {}
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        pid_t pid;
+        std::string root;
+        NameTable names;
+        ProcQuery query;            // vacía: los hilos no se filtran
+        ProcList threads;
+        ProcScanner scanner;
+        std::chrono::steady_clock::time_point last{};
+    };
+
+    void update_task(TaskGroup& t) {
+        auto now = std::chrono::steady_clock::now();
+        const double dt = std::chrono::duration<double>(now - t.last).count();
+        const bool have_prev = t.last.time_since_epoch().count() != 0;
+        t.last = now;
+
+        if (::access(t.root.c_str(), F_OK) != 0) {
+            // el proceso terminó (o aún no existe): sin hilos
+            for (const ProcInfo& th : t.threads) t.threads.remove(th.pid);
+            t.threads.commit();
+            return;
+        }
+        t.scanner.run(t.root, t.threads);
+        compact_names(t.names, t.threads);
+
+        char path[160], buf[4096];
+        for (size_t i = 0; i < t.threads.size(); ++i) {
+            ProcInfo& th = t.threads[i];
+            std::snprintf(path, sizeof(path), "%s/%d/stat", t.root.c_str(), static_cast<int>(th.pid));
+            apply_stat(th, buf, read_small_file(path, buf, sizeof(buf)), have_prev, dt);
+            std::snprintf(path, sizeof(path), "%s/%d/status", t.root.c_str(), static_cast<int>(th.pid));
+            const ssize_t n = read_small_file(path, buf, sizeof(buf));
+            unsigned long long v = 0, iv = 0;
+            if (n <= 0 || !parse_ctxt_switches(buf, buf + n, v, iv)) continue;
+            // todo hilo vivo ya ha cambiado de contexto: 0 = sin lectura previa
+            const bool rate = have_prev && dt > 0 && (th.vcsw || th.ivcsw) && v >= th.vcsw && iv >= th.ivcsw;
+            th.vcsw_s = rate ? static_cast<float>((v - th.vcsw) / dt) : -1.0f;
+            th.ivcsw_s = rate ? static_cast<float>((iv - th.ivcsw) / dt) : -1.0f;
+            th.vcsw = v;
+            th.ivcsw = iv;
+        }
+    }
+
+    void apply_stat(ProcInfo& p, const char *buf, ssize_t n, bool have_prev, double dt) const {
+        ProcStat st;
+        if (n <= 0 || !parse_proc_stat(buf, buf + n, st)) return;
+
+        unsigned long long prev = p.utime + p.stime;
+        p.cpu_pct = (have_prev && p.sampled && dt > 0 && st.utime + st.stime >= prev)
+            ? (double(st.utime + st.stime - prev) / clk_tck_) / dt * 100.0 : 0.0;
+        p.utime = st.utime;
+        p.stime = st.stime;
+        p.rss_kb = st.rss_pages * page_kb_;
+        p.cpu = st.processor;
+        p.sampled = true;
+    }
+
+    std::string root_;
+    ProcessBackends backends_;
+    bool opened_ = false;
+    NameTable names_;
+    ProcList procs_;
+    std::vector<uint32_t> rows_;    // índices no excluidos de procs_
+    ProcQuery query_;
+    WorkPool pool_;
+    UringReader uring_;
+    bool want_uring_ = true;
+    ProcScanner scanner_{ pool_, uring_, names_, query_ };
+    std::vector<std::unique_ptr<TaskGroup>> tasks_;
+    std::chrono::steady_clock::time_point last_{};
+    const double clk_tck_ = static_cast<double>(sysconf(_SC_CLK_TCK));
+    const unsigned long long page_kb_ = static_cast<unsigned long long>(sysconf(_SC_PAGESIZE)) / 1024;
+};
+#endif
+
+// Deja en out los query.top primeros procesos no excluidos en el orden de
+// query.sort. Montículo acotado a top entradas cuya cima es la peor de las
+// elegidas: O(N log top), sin copiar ni ordenar la tabla.
+static void select_top(const ProcessTable& table, std::vector<const ProcInfo*>& out) {
+    const ProcQuery& q = table.query();
+    auto before = [&](const ProcInfo *a, const ProcInfo *b) { return q.before(*a, *b); };
+    out.clear();
+    if (q.top == 0) return;
+    for (const ProcInfo& p : table.entries()) {
+        if (p.excluded) continue;
+        if (out.size() < q.top) {
+            out.push_back(&p);
+            std::push_heap(out.begin(), out.end(), before);
+        } else if (before(&p, out.front())) {
+            std::pop_heap(out.begin(), out.end(), before);
+            out.back() = &p;
+            std::push_heap(out.begin(), out.end(), before);
+        }
+    }
+    std::sort_heap(out.begin(), out.end(), before);
+}
+
+// Compatibilidad: lista ordenada por PID desde una tabla compartida. Los
+// nombres apuntan a esa tabla y valen hasta la siguiente llamada.
+std::vector<ProcInfo> list_processes() {
+    static ProcessTable table;
+    table.refresh();
+    return std::vector<ProcInfo>(table.entries().begin(), table.entries().end());
+}
+
+// Lo mismo para los hilos de pid (pid de cada entrada = TID). La tabla
+// recuerda el último pid pedido: llamadas seguidas con el mismo pid dan
+// CPU% y cambios de contexto por segundo entre llamadas.
+std::vector<ProcInfo> list_processes(proc_id pid) {
+    static ProcessTable table;
+    table.set_tasks({ pid });
+    table.refresh_tasks();
+    const ProcList& threads = table.task_threads(0);
+    return std::vector<ProcInfo>(threads.begin(), threads.end());
+}
+
+// ------------------------ Cgroups (cpu.stat) ----------------------
+// --cgroups: contabilidad de CPU por cgroup v2, que en contenedores es la
+// granularidad útil. El árbol se recorre una vez al abrir, con un watch de
+// inotify por directorio: un mkdir/rmdir de un grupo solo recorre (o quita)
+// ese subárbol y se fusiona por ruta en la lista ordenada, como ProcScanner
+// con los PID; los grupos que siguen conservan su fd y sus contadores. Sin
+// inotify (o si la cola se desborda) se vuelve a recorrer todo, como mucho
+// cada kRescanNs. Por tick solo hay un pread de cpu.stat por grupo.
+struct CgroupSample {
+    char path[96];          // relativa a la raíz; si no cabe, se recorta por la izquierda
+    float usage_pct;        // % de una CPU
+    float throttled_pct;    // % del intervalo estrangulado por cpu.max
+    float throttles_s;      // nr_throttled por segundo
+};
+
+#ifndef _WIN32
+struct CgroupCpuStat { unsigned long long usage_usec = 0, throttled_usec = 0, nr_throttled = 0; };
+
+// Las claves que faltan (throttled_* en la raíz o sin el controlador cpu) quedan a 0.
+static bool parse_cpu_stat(const char *p, const char *end, CgroupCpuStat& st) {
+    bool usage = false;
+    while (p < end) {
+        const char *eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char *sp = static_cast<const char*>(std::memchr(p, ' ', eol - p));
+        if (sp) {
+            const size_t k = sp - p;
+            if (k == 10 && std::memcmp(p, "usage_usec", 10) == 0) { st.usage_usec = parse_ull(sp + 1, eol); usage = true; }
+            else if (k == 14 && std::memcmp(p, "throttled_usec", 14) == 0) st.throttled_usec = parse_ull(sp + 1, eol);
+            else if (k == 12 && std::memcmp(p, "nr_throttled", 12) == 0) st.nr_throttled = parse_ull(sp + 1, eol);
+        }
+        p = eol + 1;
+    }
+    return usage;
+}
+
+class CgroupTable {
+public:
+    static constexpr int64_t kRescanNs = 2000000000LL;   // sin inotify
+    static const size_t kMaxGroups = 4096;
+
+    CgroupTable() = default;
+    ~CgroupTable() {
+        for (Group& g : groups_) if (g.fd >= 0) ::close(g.fd);
+        if (notify_fd_ >= 0) ::close(notify_fd_);
+    }
+    CgroupTable(const CgroupTable&) = delete;
+    CgroupTable& operator=(const CgroupTable&) = delete;
+
+    // Sin root, /sys/fs/cgroup si es v2 puro o /sys/fs/cgroup/unified en
+    // modo híbrido. false si no hay jerarquía v2 con cpu.stat.
+    bool open(const char *root = nullptr) {
+        if (root) return open_root(root);
+        return open_root("/sys/fs/cgroup") || open_root("/sys/fs/cgroup/unified");
+    }
+    bool active() const { return !groups_.empty(); }
+    size_t size() const { return groups_.size(); }
+    const std::string& root() const { return root_; }
+
+    void refresh() {
+        const int64_t now = monotonic_ns();
+        if (notify_fd_ >= 0) {
+            if (drain_events()) scan();
+        } else if (now - scan_ns_ >= kRescanNs) {
+            scan();
+        }
+        const double dt_us = last_ns_ ? (now - last_ns_) / 1e3 : 0.0;
+        last_ns_ = now;
+        char buf[1024];
+        for (Group& g : groups_) {
+            if (g.fd < 0) continue;
+            const ssize_t n = ::pread(g.fd, buf, sizeof(buf), 0);
+            CgroupCpuStat st;
+            if (n <= 0 || !parse_cpu_stat(buf, buf + n, st)) {
+                // ENODEV: el grupo se borró; el próximo scan() lo quita
+                ::close(g.fd);
+                g.fd = -1;
+                g.usage_pct = -1;
+                continue;
+            }
+            if (g.primed && dt_us > 0 && st.usage_usec >= g.last.usage_usec) {
+                g.usage_pct = static_cast<float>((st.usage_usec - g.last.usage_usec) * 100.0 / dt_us);
+                g.throttled_pct = static_cast<float>((st.throttled_usec - g.last.throttled_usec) * 100.0 / dt_us);
+                g.throttles_s = static_cast<float>((st.nr_throttled - g.last.nr_throttled) * 1e6 / dt_us);
+            }
+            g.last = st;
+            g.primed = true;
+        }
+    }
+
+    // Los n grupos con más uso, de mayor a menor.
+    void top(size_t n, std::vector<CgroupSample>& out) {
+        order_.clear();
+        for (size_t i = 0; i < groups_.size(); ++i)
+            if (groups_[i].usage_pct >= 0) order_.push_back(static_cast<uint32_t>(i));
+        n = std::min(n, order_.size());
+        std::partial_sort(order_.begin(), order_.begin() + n, order_.end(), [&](uint32_t a, uint32_t b) {
+            if (groups_[a].usage_pct != groups_[b].usage_pct) return groups_[a].usage_pct > groups_[b].usage_pct;
+            return a < b;
+        });
+        out.clear();
+        for (size_t k = 0; k < n; ++k) {
+            const Group& g = groups_[order_[k]];
+            CgroupSample cs{ {}, g.usage_pct, g.throttled_pct, g.throttles_s };
+            const char *p = g.path.c_str();
+            const size_t len = g.path.size();
+            if (len >= sizeof(cs.path)) p += len - (sizeof(cs.path) - 1);
+            std::snprintf(cs.path, sizeof(cs.path), "%s", p);
+            out.push_back(cs);
+        }
+    }
+
+private:
+    struct Group {
+        std::string path;       // "/" para la raíz
+        int fd = -1;
+        bool primed = false;
+        CgroupCpuStat last;
+        float usage_pct = -1, throttled_pct = 0, throttles_s = 0;
+    };
+
+    bool open_root(const char *base) {
+        root_ = base;
+        if (::access((root_ + "/cgroup.controllers").c_str(), F_OK) != 0) return false;
+        if (notify_fd_ < 0) notify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        scan();
+        return active();
+    }
+
+    static std::string join(const std::string& rel, const char *name) {
+        return rel == "/" ? rel + name : rel + "/" + name;
+    }
+
+    void watch(const std::string& rel, const std::string& dir) {
+        if (notify_fd_ < 0) return;
+        const int wd = ::inotify_add_watch(notify_fd_, dir.c_str(),
+                                           IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+        if (wd >= 0) watches_[wd] = rel;
+    }
+
+    void walk(const std::string& rel) {
+        if (kept_ + seen_.size() >= kMaxGroups) return;
+        seen_.push_back(rel);
+        const std::string dir = rel == "/" ? root_ : root_ + rel;
+        watch(rel, dir);
+        DIR *d = opendir(dir.c_str());
+        if (!d) return;
+        while (dirent *e = readdir(d)) {
+            if (e->d_name[0] == '.') continue;
+            bool is_dir = e->d_type == DT_DIR;
+            if (e->d_type == DT_UNKNOWN) {
+                struct stat sb;
+                is_dir = ::stat((dir + "/" + e->d_name).c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+            }
+            if (is_dir) walk(join(rel, e->d_name));
+        }
+        closedir(d);
+    }
+
+    // Aplica los eventos de inotify pendientes; true si hace falta un
+    // recorrido completo (cola desbordada).
+    bool drain_events() {
+        alignas(inotify_event) char buf[4096];
+        bool full = false;
+        for (;;) {
+            const ssize_t n = ::read(notify_fd_, buf, sizeof(buf));
+            if (n <= 0) return full;
+            for (const char *p = buf; p < buf + n; ) {
+                const inotify_event *ev = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) { full = true; continue; }
+                auto it = watches_.find(ev->wd);
+                if (it == watches_.end()) continue;
+                if (ev->mask & IN_IGNORED) { watches_.erase(it); continue; }
+                if (!(ev->mask & IN_ISDIR) || ev->len == 0) continue;
+                const std::string rel = join(it->second, ev->name);
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) add_subtree(rel);
+                else remove_subtree(rel);
+            }
+        }
+    }
+
+    // Grupo nuevo: se recorre solo su subárbol y se inserta en orden.
+    void add_subtree(const std::string& rel) {
+        seen_.clear();
+        kept_ = groups_.size();
+        walk(rel);
+        std::sort(seen_.begin(), seen_.end());
+        for (std::string& path : seen_) {
+            auto pos = std::lower_bound(groups_.begin(), groups_.end(), path,
+                                        [](const Group& g, const std::string& p) { return g.path < p; });
+            if (pos != groups_.end() && pos->path == path) continue;
+            Group g;
+            g.fd = ::open((root_ + path + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+            if (g.fd < 0) continue;
+            g.path = std::move(path);
+            groups_.insert(pos, std::move(g));
+        }
+    }
+
+    // Grupo borrado: fuera él y sus descendientes (sus watches se van solos).
+    void remove_subtree(const std::string& rel) {
+        auto first = std::lower_bound(groups_.begin(), groups_.end(), rel,
+                                      [](const Group& g, const std::string& p) { return g.path < p; });
+        auto last = first;
+        while (last != groups_.end() && last->path.compare(0, rel.size(), rel) == 0 &&
+               (last->path.size() == rel.size() || last->path[rel.size()] == '/')) {
+            if (last->fd >= 0) ::close(last->fd);
+            ++last;
+        }
+        groups_.erase(first, last);
+    }
+
+    // Fusión ordenada: se quedan los que siguen (con su fd), se abren los
+    // nuevos y se cierran los desaparecidos.
+    void scan() {
+        scan_ns_ = monotonic_ns();
+        seen_.clear();
+        kept_ = 0;
+        watches_.clear();    // inotify devuelve el mismo wd para un directorio ya vigilado
+        walk("/");
+        std::sort(seen_.begin(), seen_.end());
+        spare_.clear();
+        spare_.reserve(seen_.size());
+        size_t i = 0;
+        for (std::string& path : seen_) {
+            while (i < groups_.size() && groups_[i].path < path) {
+                if (groups_[i].fd >= 0) ::close(groups_[i].fd);
+                ++i;
+            }
+            if (i < groups_.size() && groups_[i].path == path && groups_[i].fd >= 0) {
+                spare_.push_back(std::move(groups_[i++]));
+                continue;
+            }
+            if (i < groups_.size() && groups_[i].path == path) ++i;    // fd muerto: reabrir
+            const std::string file = (path == "/" ? root_ : root_ + path) + "/cpu.stat";
+            Group g;
+            g.fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (g.fd < 0) continue;
+            g.path = std::move(path);
+            spare_.push_back(std::move(g));
+        }
+        for (; i < groups_.size(); ++i)
+            if (groups_[i].fd >= 0) ::close(groups_[i].fd);
+        groups_.swap(spare_);
+        spare_.clear();
+    }
+
+    std::string root_;
+    std::vector<Group> groups_, spare_;
+    std::vector<std::string> seen_;
+    std::vector<uint32_t> order_;
+    std::unordered_map<int, std::string> watches_;   // wd de inotify -> ruta relativa
+    size_t kept_ = 0;        // grupos que ya cuentan contra kMaxGroups en walk()
+    int notify_fd_ = -1;
+    int64_t scan_ns_ = 0, last_ns_ = 0;
+};
+#else
+// Windows no tiene cgroups: --cgroups avisa y no muestra nada.
+class CgroupTable {
+public:
+    bool open(const char * = nullptr) { return false; }
+    bool active() const { return false; }
+    size_t size() const { return 0; }
+    void refresh() {}
+    void top(size_t, std::vector<CgroupSample>& out) { out.clear(); }
+};
+#endif
+
+// ---------------------------- Muestreo ---------------------------
+// Un hilo muestreador escribe cada muestra en un ring buffer de capacidad
+// fija (un productor, varios consumidores). Cada slot lleva un seqlock: el
+// productor nunca espera y cada lector copia la muestra y reintenta si el
+// slot cambió mientras copiaba. La TUI y los exportadores leen de aquí.
+struct ProcSample {
+    long long pid;
+    double cpu_pct;
+    unsigned long long rss_kb;
+    char name[32];
+};
+
+// Hilo de un PID de --tasks; los de cada PID van juntos, de más a menos CPU.
+struct ThreadSample {
+    long long pid, tid;
+    double cpu_pct;
+    int cpu;                          // CPU de la última ejecución; -1 = N/D
+    float vcsw_s, ivcsw_s;            // cambios de contexto voluntarios/involuntarios por s; -1 = N/D
+    char name[32];
+};
+
+struct Sample {
+    uint64_t seq = 0;                // 1, 2, 3... (0 = ninguna)
+    int64_t t_ns = 0;                // CLOCK_MONOTONIC al tomar la muestra
+    std::vector<double> mhz;         // por id de CPU; -1 = N/D
+    std::vector<CoreUtil> util;      // por id de CPU
+    std::vector<CoreCounters> hw;    // por id de CPU; vacío sin --perf
+    std::vector<CoreTransitions> trans;  // por id de CPU; vacío sin la fuente tracepoint
+    std::vector<CoreThermal> thermal;    // por id de CPU; vacío sin --thermal
+    std::vector<ProcSample> top;     // en el orden de --sort (CPU% por defecto)
+    std::vector<CgroupSample> cgroups;  // de mayor a menor uso; vacío sin --cgroups
+    std::vector<ThreadSample> threads;  // vacío sin --tasks
+    uint32_t period_ms = 0;          // periodo de muestreo en curso; 0 = el de --interval
+    bool burst = false;              // --adaptive en ráfaga
+};
+
+class SampleRing {
+public:
+    SampleRing(size_t slots, size_t max_cpus, size_t max_procs, size_t max_cgroups = 0, size_t max_threads = 0)
+        : mask_(round_pow2(slots) - 1), max_cpus_(max_cpus), max_procs_(max_procs),
+          max_cgroups_(max_cgroups), max_threads_(max_threads), slots_(mask_ + 1) {
+        for (Slot& s : slots_) {
+            s.mhz.reset(new double[max_cpus_]);
+            s.util.reset(new CoreUtil[max_cpus_]);
+            s.hw.reset(new CoreCounters[max_cpus_]);
+            s.trans.reset(new CoreTransitions[max_cpus_]);
+            s.thermal.reset(new CoreThermal[max_cpus_]);
+            s.top.reset(new ProcSample[max_procs_]);
+            s.cg.reset(new CgroupSample[max_cgroups_]);
+            s.th.reset(new ThreadSample[max_threads_]);
+        }
+    }
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    // Solo el hilo productor. Lo que exceda la capacidad se recorta.
+    void push(const Sample& in) {
+        const uint64_t id = head_.load(std::memory_order_relaxed) + 1;
+        Slot& s = slots_[id & mask_];
+        const uint64_t v = s.version.load(std::memory_order_relaxed);
+        s.version.store(v + 1, std::memory_order_relaxed);   // impar: escribiendo
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const size_t nc = std::min(in.mhz.size(), max_cpus_);
+        const size_t nu = std::min(in.util.size(), max_cpus_);
+        const size_t nh = std::min(in.hw.size(), max_cpus_);
+        const size_t nt = std::min(in.trans.size(), max_cpus_);
+        const size_t nth = std::min(in.thermal.size(), max_cpus_);
+        const size_t np = std::min(in.top.size(), max_procs_);
+        const size_t ng = std::min(in.cgroups.size(), max_cgroups_);
+        const size_t ntk = std::min(in.threads.size(), max_threads_);
+        std::copy_n(in.mhz.begin(), nc, s.mhz.get());
+        std::copy_n(in.util.begin(), nu, s.util.get());
+        std::copy_n(in.hw.begin(), nh, s.hw.get());
+        std::copy_n(in.trans.begin(), nt, s.trans.get());
+        std::copy_n(in.thermal.begin(), nth, s.thermal.get());
+        std::copy_n(in.top.begin(), np, s.top.get());
+        std::copy_n(in.cgroups.begin(), ng, s.cg.get());
+        std::copy_n(in.threads.begin(), ntk, s.th.get());
+        s.ncpu.store(static_cast<uint32_t>(nc), std::memory_order_relaxed);
+        s.nutil.store(static_cast<uint32_t>(nu), std::memory_order_relaxed);
+        s.nhw.store(static_cast<uint32_t>(nh), std::memory_order_relaxed);
+        s.ntrans.store(static_cast<uint32_t>(nt), std::memory_order_relaxed);
+        s.nthermal.store(static_cast<uint32_t>(nth), std::memory_order_relaxed);
+        s.nproc.store(static_cast<uint32_t>(np), std::memory_order_relaxed);
+        s.ncg.store(static_cast<uint32_t>(ng), std::memory_order_relaxed);
+        s.nthreads.store(static_cast<uint32_t>(ntk), std::memory_order_relaxed);
+        s.t_ns.store(in.t_ns, std::memory_order_relaxed);
+        s.period.store(in.period_ms | (in.burst ? kBurstBit : 0u), std::memory_order_relaxed);
+        s.id.store(id, std::memory_order_relaxed);
+
+        s.version.store(v + 2, std::memory_order_release);
+        head_.store(id, std::memory_order_release);
+        // sin lock: quien esté dormido en wait() se despierta
+        cv_.notify_all();
+    }
+
+    uint64_t head() const { return head_.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask_ + 1; }
+
+    // Copia la muestra id en out. false si aún no existe o ya se sobrescribió.
+    bool read(uint64_t id, Sample& out) const {
+        if (id == 0 || id > head()) return false;
+        const Slot& s = slots_[id & mask_];
+        for (;;) {
+            const uint64_t v1 = s.version.load(std::memory_order_acquire);
+            if (v1 & 1) { std::this_thread::yield(); continue; }
+            if (s.id.load(std::memory_order_relaxed) != id) return false;
+            const size_t nc = std::min<size_t>(s.ncpu.load(std::memory_order_relaxed), max_cpus_);
+            const size_t nu = std::min<size_t>(s.nutil.load(std::memory_order_relaxed), max_cpus_);
+            const size_t nh = std::min<size_t>(s.nhw.load(std::memory_order_relaxed), max_cpus_);
+            const size_t nt = std::min<size_t>(s.ntrans.load(std::memory_order_relaxed), max_cpus_);
+            const size_t nth = std::min<size_t>(s.nthermal.load(std::memory_order_relaxed), max_cpus_);
+            const size_t np = std::min<size_t>(s.nproc.load(std::memory_order_relaxed), max_procs_);
+            const size_t ng = std::min<size_t>(s.ncg.load(std::memory_order_relaxed), max_cgroups_);
+            const size_t ntk = std::min<size_t>(s.nthreads.load(std::memory_order_relaxed), max_threads_);
+            out.mhz.assign(s.mhz.get(), s.mhz.get() + nc);
+            out.util.assign(s.util.get(), s.util.get() + nu);
+            out.hw.assign(s.hw.get(), s.hw.get() + nh);
+            out.trans.assign(s.trans.get(), s.trans.get() + nt);
+            out.thermal.assign(s.thermal.get(), s.thermal.get() + nth);
+            out.top.assign(s.top.get(), s.top.get() + np);
+            out.cgroups.assign(s.cg.get(), s.cg.get() + ng);
+            out.threads.assign(s.th.get(), s.th.get() + ntk);
+            const int64_t t = s.t_ns.load(std::memory_order_relaxed);
+            const uint32_t p = s.period.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.version.load(std::memory_order_relaxed) == v1) {
+                out.seq = id;
+                out.t_ns = t;
+                out.period_ms = p & ~kBurstBit;
+                out.burst = (p & kBurstBit) != 0;
+                return true;
+            }
+        }
+    }
+
+    // La muestra más reciente si es más nueva que out.seq.
+    bool read_latest(Sample& out) const {
+        for (;;) {
+            const uint64_t id = head();
+            if (id == 0 || id == out.seq) return false;
+            if (read(id, out)) return true;
+        }
+    }
+
+    // Espera (como mucho timeout) a que haya una muestra posterior a seq.
+    void wait(uint64_t seq, std::chrono::milliseconds timeout) const {
+        std::unique_lock<std::mutex> lk(wait_mu_);
+        cv_.wait_for(lk, timeout, [&] { return head() > seq || g_stop; });
+    }
+
+private:
+    static constexpr uint32_t kBurstBit = 0x80000000u;
+
+    struct Slot {
+        std::atomic<uint64_t> version{0};   // seqlock
+        std::atomic<uint64_t> id{0};
+        std::atomic<int64_t> t_ns{0};
+        std::atomic<uint32_t> ncpu{0}, nutil{0}, nhw{0}, ntrans{0}, nthermal{0}, nproc{0}, ncg{0};
+        std::atomic<uint32_t> period{0};   // period_ms | kBurstBit
+        std::atomic<uint32_t> nthreads{0};
+        std::unique_ptr<double[]> mhz;
+        std::unique_ptr<CoreUtil[]> util;
+        std::unique_ptr<CoreCounters[]> hw;
+        std::unique_ptr<CoreTransitions[]> trans;
+        std::unique_ptr<CoreThermal[]> thermal;
+        std::unique_ptr<ProcSample[]> top;
+        std::unique_ptr<CgroupSample[]> cg;
+        std::unique_ptr<ThreadSample[]> th;
+    };
+
+    static size_t round_pow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    const size_t mask_, max_cpus_, max_procs_, max_cgroups_, max_threads_;
+    std::vector<Slot> slots_;
+    std::atomic<uint64_t> head_{0};
+    mutable std::mutex wait_mu_;
+    mutable std::condition_variable cv_;
+};
+
+// Despierta en una rejilla fija t0 + k*periodo con plazos absolutos, así el
+// trabajo de cada tick no se acumula como deriva. Si un tick se retrasa más
+// de un periodo, se saltan los puntos perdidos en vez de recuperarlos.
+class TickScheduler {
+public:
+    explicit TickScheduler(int64_t period_ns)
+        : period_(period_ns), next_(monotonic_ns() + period_ns) {
+#ifdef _WIN32
+        timer_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                        TIMER_ALL_ACCESS);
+        if (!timer_) timer_ = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+#endif
+    }
+#ifdef _WIN32
+    ~TickScheduler() { if (timer_) CloseHandle(timer_); }
+#endif
+    TickScheduler(const TickScheduler&) = delete;
+    TickScheduler& operator=(const TickScheduler&) = delete;
+
+    void wait_next() {
+#ifdef _WIN32
+        // los waitable timers absolutos usan la hora del sistema; se programa
+        // el tiempo relativo que falta hasta el plazo monotónico
+        int64_t left = next_ - monotonic_ns();
+        if (left > 0 && timer_) {
+            LARGE_INTEGER due;
+            due.QuadPart = -(left / 100);
+            if (SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE))
+                WaitForSingleObject(timer_, INFINITE);
+        }
+#else
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(next_ / 1000000000LL);
+        ts.tv_nsec = static_cast<long>(next_ % 1000000000LL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && !g_stop) {}
+#endif
+        next_ += period_;
+        const int64_t now = monotonic_ns();
+        if (now >= next_) next_ += ((now - next_) / period_ + 1) * period_;
+    }
+
+    // Cambia el periodo desde el plazo ya programado: el próximo tick llega
+    // un periodo nuevo después del último.
+    void set_period(int64_t period_ns) {
+        if (period_ns == period_ || period_ns <= 0) return;
+        next_ += period_ns - period_;
+        period_ = period_ns;
+    }
+
+private:
+    int64_t period_;
+    int64_t next_;
+#ifdef _WIN32
+    HANDLE timer_ = nullptr;
+#endif
+};
+
+// Coste del propio monitor, para el pie de la TUI y las métricas
+// inexcpu_self_*: CPU de todo el proceso, RSS y llamadas al sistema de E/S
+// (syscr + syscw de /proc/self/io; en Windows las operaciones de
+// GetProcessIoCounters). Las tasas salen entre dos llamadas a sample(), así
+// que cada consumidor tiene su propio SelfMeter.
+struct SelfCost {
+    double cpu_s = 0;                 // CPU acumulada (usuario + sistema)
+    double cpu_pct = -1;              // de una CPU desde la muestra anterior; -1 = N/D
+    unsigned long long rss_kb = 0;
+    unsigned long long syscalls = 0;  // acumuladas
+    double syscalls_s = -1;           // -1 = N/D
+};
+
+class SelfMeter {
+public:
+    SelfMeter() {
+#ifndef _WIN32
+        statm_fd_ = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+        io_fd_ = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+#endif
+    }
+#ifndef _WIN32
+    ~SelfMeter() {
+        if (statm_fd_ >= 0) ::close(statm_fd_);
+        if (io_fd_ >= 0) ::close(io_fd_);
+    }
+#endif
+    SelfMeter(const SelfMeter&) = delete;
+    SelfMeter& operator=(const SelfMeter&) = delete;
+
+    const SelfCost& sample() {
+        const int64_t now = monotonic_ns();
+        SelfCost c;
+#ifdef _WIN32
+        FILETIME ct, et, kt, ut;
+        if (GetProcessTimes(GetCurrentProcess(), &ct, &et, &kt, &ut))
+            c.cpu_s = (filetime_u64(kt) + filetime_u64(ut)) / 1e7;
+        PROCESS_MEMORY_COUNTERS pmc;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) c.rss_kb = pmc.WorkingSetSize / 1024;
+        IO_COUNTERS io;
+        if (GetProcessIoCounters(GetCurrentProcess(), &io))
+            c.syscalls = io.ReadOperationCount + io.WriteOperationCount + io.OtherOperationCount;
+#else
+        struct timespec ts;
+        if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) c.cpu_s = ts.tv_sec + ts.tv_nsec / 1e9;
+        char buf[256];
+        ssize_t n;
+        if (statm_fd_ >= 0 && (n = ::pread(statm_fd_, buf, sizeof(buf) - 1, 0)) > 0) {
+            buf[n] = '\0';
+            unsigned long long size = 0, res = 0;
+            if (std::sscanf(buf, "%llu %llu", &size, &res) == 2)
+                c.rss_kb = res * static_cast<unsigned long long>(sysconf(_SC_PAGESIZE)) / 1024;
+        }
+        if (io_fd_ >= 0 && (n = ::pread(io_fd_, buf, sizeof(buf) - 1, 0)) > 0) {
+            buf[n] = '\0';
+            const char *r = std::strstr(buf, "syscr:"), *w = std::strstr(buf, "syscw:");
+            if (r && w) c.syscalls = std::strtoull(r + 6, nullptr, 10) + std::strtoull(w + 6, nullptr, 10);
+        }
+#endif
+        if (t_ns_) {
+            const double dt = (now - t_ns_) / 1e9;
+            if (dt > 0) {
+                c.cpu_pct = (c.cpu_s - cur_.cpu_s) * 100.0 / dt;
+                if (c.syscalls >= cur_.syscalls) c.syscalls_s = (c.syscalls - cur_.syscalls) / dt;
+            }
+        }
+        t_ns_ = now;
+        cur_ = c;
+        return cur_;
+    }
+
+    const SelfCost& last() const { return cur_; }
+
+private:
+#ifdef _WIN32
+    static unsigned long long filetime_u64(const FILETIME& f) {
+        return (static_cast<unsigned long long>(f.dwHighDateTime) << 32) | f.dwLowDateTime;
+    }
+#else
+    int statm_fd_ = -1, io_fd_ = -1;
+#endif
+    SelfCost cur_;
+    int64_t t_ns_ = 0;
+};
+
+// --pin-cpu: todo el monitor en una CPU de servicio, para no migrar ni
+// despertar los núcleos que mide. Se llama antes de crear ningún hilo, que
+// heredan la afinidad. El conjunto se reserva al tamaño de possible, así
+// que vale para más de CPU_SETSIZE (1024) CPUs. En Windows la CPU lineal se
+// traduce a (grupo, bit); fuera del grupo 0 la afinidad es por hilo y el
+// hilo del muestreador vuelve a llamar a esto.
+static bool pin_to_cpu(int cpu) {
+#ifdef _WIN32
+    if (cpu < 0) return false;
+    WORD group = 0;
+    DWORD bit = static_cast<DWORD>(cpu);
+    const WORD ngroups = GetActiveProcessorGroupCount();
+    while (group < ngroups && bit >= GetActiveProcessorCount(group)) bit -= GetActiveProcessorCount(group++);
+    if (group == ngroups || bit >= sizeof(KAFFINITY) * 8) return false;
+    if (ngroups == 1) return SetProcessAffinityMask(GetCurrentProcess(), KAFFINITY(1) << bit) != 0;
+    GROUP_AFFINITY ga{};
+    ga.Group = group;
+    ga.Mask = KAFFINITY(1) << bit;
+    return SetThreadGroupAffinity(GetCurrentThread(), &ga, nullptr) != 0;
+#else
+    const size_t ncpu = std::max<size_t>(cpu_possible(), CPU_SETSIZE);
+    if (cpu < 0 || static_cast<size_t>(cpu) >= ncpu) { errno = EINVAL; return false; }
+    cpu_set_t *set = CPU_ALLOC(ncpu);
+    if (!set) return false;
+    const size_t size = CPU_ALLOC_SIZE(ncpu);
+    CPU_ZERO_S(size, set);
+    CPU_SET_S(cpu, size, set);
+    const bool ok = sched_setaffinity(0, size, set) == 0;
+    CPU_FREE(set);
+    return ok;
+#endif
+}
+
+// --rt: el hilo que llama pasa a SCHED_FIFO (o THREAD_PRIORITY_TIME_CRITICAL
+// en Windows) para que los ticks no esperen a otras tareas. El muestreador
+// duerme casi siempre, así que no acapara la CPU.
+static bool set_realtime() {
+#ifdef _WIN32
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+    sched_param sp{};
+    sp.sched_priority = std::min(10, sched_get_priority_max(SCHED_FIFO));
+    errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    return errno == 0;
+#endif
+}
+
+// --adaptive: con el sistema quieto se muestrea menos y ante una anomalía
+// se pasa a ráfaga. Un núcleo cuya frecuencia no se mueve más de un 1 %
+// durante kStableTicks lecturas se relee cada 2, luego 4 y hasta kMaxSkip
+// ticks; la tabla de procesos (y la de cgroups) se refresca cada vez menos,
+// hasta kMaxProcSkip periodos, mientras no aparezcan ni desaparezcan PIDs.
+// Una caída de frecuencia de más del 15 % respecto a la última lectura que
+// se mantuvo estable, un salto de uso de más de 40 puntos o un proceso nuevo
+// en cabeza del top activan la ráfaga: ticks de kBurstMs durante kBurstNs
+// releyendo todos los núcleos; los procesos siguen al ritmo de --interval,
+// que es lo caro. Solo un disparo de otro tipo alarga una ráfaga en curso, y
+// el uso no se mira durante ella: a 10 ms /proc/stat cuenta en ticks enteros
+// de USER_HZ y cada núcleo salta entre 0 y 100 %.
+class AdaptivePolicy {
+public:
+    static constexpr int kBurstMs = 10;                    // 100 Hz
+    static constexpr int64_t kBurstNs = 10000000000LL;     // 10 s
+    static constexpr uint32_t kStableTicks = 5, kMaxSkip = 8, kMaxProcSkip = 8;
+    static constexpr double kNewTopPct = 10.0;
+
+    explicit AdaptivePolicy(int base_ms) : base_ms_(base_ms) {}
+    AdaptivePolicy(const AdaptivePolicy&) = delete;
+    AdaptivePolicy& operator=(const AdaptivePolicy&) = delete;
+
+    bool burst() const { return burst_until_ != 0; }
+    int period_ms() const { return burst() ? std::min(kBurstMs, base_ms_) : base_ms_; }
+
+    // Núcleos a releer en este tick (1 = sí); vacío la primera vez = todos.
+    const std::vector<uint8_t>& due_cores() {
+        for (size_t c = 0; c < due_.size(); ++c)
+            due_[c] = burst() || wait_[c] == 0;
+        return due_;
+    }
+
+    // ¿Toca refrescar procesos? Con margen de medio periodo por el jitter.
+    bool proc_due(int64_t now) const {
+        const int64_t base = static_cast<int64_t>(base_ms_) * 1000000LL;
+        return last_proc_ns_ == 0 || now - last_proc_ns_ >= base * proc_skip_ - base / 2;
+    }
+
+    // Tras cada muestra: actualiza la estabilidad por núcleo y el ritmo de
+    // procesos y decide si entra o sale de ráfaga.
+    void observe(const Sample& s, bool procs_refreshed, uint64_t proc_changes) {
+        unsigned anomaly = 0;
+        const size_t n = s.mhz.size();
+        if (due_.size() != n) {
+            due_.assign(n, 1);
+            ref_.assign(n, -1.0);
+            steady_.assign(n, -1.0);
+            stable_.assign(n, 0);
+            wait_.assign(n, 0);
+            busy_.assign(n, -1.0);
+        }
+        for (size_t c = 0; c < n; ++c) {
+            if (due_[c]) {
+                const double f = s.mhz[c];
+                if (f > 0 && steady_[c] > 0 && f < steady_[c] * 0.85) {
+                    anomaly |= kTrigFreq;
+                    steady_[c] = -1.0;   // hasta que vuelva a estabilizarse
+                }
+                if (f > 0 && ref_[c] > 0 && std::fabs(f - ref_[c]) <= ref_[c] * 0.01) {
+                    if (++stable_[c] >= kStableTicks) steady_[c] = f;
+                } else {
+                    stable_[c] = 0;
+                    ref_[c] = f;
+                }
+                uint32_t skip = 1;
+                if (stable_[c] >= kStableTicks)
+                    skip = std::min(kMaxSkip, 2u << std::min(stable_[c] / kStableTicks - 1, 3u));
+                wait_[c] = skip - 1;
+            } else if (wait_[c]) {
+                --wait_[c];
+            }
+            if (burst()) continue;
+            const double b = c < s.util.size() ? s.util[c].busy : -1.0;
+            if (b >= 0 && busy_[c] >= 0 && b - busy_[c] > 40.0) anomaly |= kTrigBusy;
+            busy_[c] = b;
+        }
+
+        if (procs_refreshed) {
+            if (!s.top.empty()) {
+                // solo cuenta un recién llegado que de verdad gaste CPU
+                const ProcSample& head = s.top.front();
+                if (!top_.empty() && head.cpu_pct >= kNewTopPct &&
+                    std::find(top_.begin(), top_.end(), head.pid) == top_.end())
+                    anomaly |= kTrigTop;
+                top_.clear();
+                for (const ProcSample& p : s.top) top_.push_back(p.pid);
+            }
+            if (last_proc_ns_ && proc_changes == proc_changes_) {
+                if (++proc_quiet_ % kStableTicks == 0) proc_skip_ = std::min(kMaxProcSkip, proc_skip_ * 2);
+            } else {
+                proc_quiet_ = 0;
+                proc_skip_ = 1;
+            }
+            proc_changes_ = proc_changes;
+            last_proc_ns_ = s.t_ns;
+        }
+
+        if (anomaly & ~burst_trig_) {
+            burst_until_ = s.t_ns + kBurstNs;
+            burst_trig_ |= anomaly;
+            proc_skip_ = 1;
+        } else if (burst_until_ && s.t_ns >= burst_until_) {
+            burst_until_ = 0;
+            burst_trig_ = 0;
+            // el uso de la ráfaga no es comparable con el del periodo base
+            std::fill(busy_.begin(), busy_.end(), -1.0);
+        }
+    }
+
+private:
+    enum : unsigned { kTrigFreq = 1, kTrigBusy = 2, kTrigTop = 4 };
+
+    const int base_ms_;
+    std::vector<uint8_t> due_;
+    std::vector<double> ref_, steady_;     // última lectura y la última que se mantuvo
+    std::vector<double> busy_;             // último uso por núcleo (periodo base)
+    std::vector<uint32_t> stable_, wait_;  // lecturas estables y ticks hasta la próxima
+    std::vector<long long> top_;           // PIDs del último top
+    uint64_t proc_changes_ = 0;
+    uint32_t proc_quiet_ = 0, proc_skip_ = 1;
+    int64_t last_proc_ns_ = 0, burst_until_ = 0;
+    unsigned burst_trig_ = 0;              // tipos de disparo de la ráfaga en curso
+};
+
+// Tabla completa para --interactive: el muestreador deja en cada refresco
+// todos los procesos no excluidos, en binario y sin ordenar, y la TUI se
+// queda con la última. Tres vectores que se intercambian bajo un mutex (uno
+// por tick), reutilizados: sin reservas en régimen estable.
+class ProcSnapshot {
+public:
+    // Productor: rellenar back() y publicar.
+    std::vector<ProcSample>& back() { return back_; }
+    void publish() {
+        std::lock_guard<std::mutex> lock(mu_);
+        back_.swap(ready_);
+        fresh_ = true;
+    }
+    // Consumidor: true si había una tabla nueva, que queda en out.
+    bool take(std::vector<ProcSample>& out) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!fresh_) return false;
+        out.swap(ready_);
+        fresh_ = false;
+        return true;
+    }
+
+private:
+    std::mutex mu_;
+    std::vector<ProcSample> back_, ready_;
+    bool fresh_ = false;
+};
+
+static void fill_snapshot(const ProcessTable& table, ProcSnapshot& snap) {
+    std::vector<ProcSample>& out = snap.back();
+    out.clear();
+    for (const ProcInfo& p : table.entries()) {
+        if (p.excluded) continue;
+        ProcSample ps{ static_cast<long long>(p.pid), p.cpu_pct, p.rss_kb, {} };
+        const size_t n = strnlen(p.name, sizeof(ps.name) - 1);
+        std::memcpy(ps.name, p.name, n);
+        ps.name[n] = '\0';
+        out.push_back(ps);
+    }
+    snap.publish();
+}
+
+// Los per_task hilos con más CPU de cada PID de --tasks, agrupados por PID.
+static void select_threads(const ProcessTable& table, size_t per_task, std::vector<const ProcInfo*>& scratch,
+                           std::vector<ThreadSample>& out) {
+    out.clear();
+    auto hotter = [](const ProcInfo *a, const ProcInfo *b) {
+        return a->cpu_pct != b->cpu_pct ? a->cpu_pct > b->cpu_pct : a->pid < b->pid;
+    };
+    for (size_t t = 0; t < table.tasks(); ++t) {
+        scratch.clear();
+        for (const ProcInfo& th : table.task_threads(t)) scratch.push_back(&th);
+        const size_t n = std::min(per_task, scratch.size());
+        std::partial_sort(scratch.begin(), scratch.begin() + n, scratch.end(), hotter);
+        for (size_t i = 0; i < n; ++i) {
+            const ProcInfo& th = *scratch[i];
+            ThreadSample ts{ static_cast<long long>(table.task_pid(t)), static_cast<long long>(th.pid),
+                             th.cpu_pct, th.cpu, th.vcsw_s, th.ivcsw_s, {} };
+            std::snprintf(ts.name, sizeof(ts.name), "%s", th.name);
+            out.push_back(ts);
+        }
+    }
+}
+
+static const size_t kThreadsPerTask = 16;   // hilos por PID de --tasks en cada muestra
+
+// Bucle del hilo muestreador: frecuencias, uso y top-N de procesos. Con
+// perf (--perf) también los contadores hardware, con la fuente tracepoint
+// las transiciones, con --thermal temperaturas y potencia y con --cgroups
+// el uso por cgroup (los ncg con más CPU); con --tasks, los hilos más
+// activos de esos PIDs; con snap (--interactive), la tabla entera. Con adapt (--adaptive) el
+// periodo y lo que se relee en cada tick lo decide AdaptivePolicy.
+static void sampler_loop(FrequencySource& freq, UtilizationSampler& usage, ThermalSampler& thermal,
+                         ProcessTable& table, CgroupTable& cgroups, size_t ncg,
+                         SampleRing& ring, int interval_ms, AdaptivePolicy *adapt, ProcSnapshot *snap) {
+    std::vector<const ProcInfo*> top;
+    Sample s;
+    s.top.reserve(table.query().top);
+
+    TickScheduler tick(static_cast<int64_t>(interval_ms) * 1000000LL);
+    while (!g_stop) {
+        s.t_ns = monotonic_ns();
+        s.mhz = freq.sample(adapt ? &adapt->due_cores() : nullptr);
+        if (const auto *hw = freq.counters()) s.hw = *hw;
+        if (const auto *tr = freq.transitions()) s.trans = *tr;
+        if (thermal.active()) s.thermal = thermal.sample();
+        s.util = usage.sample();
+        // con --adaptive procesos y cgroups pueden saltarse ticks: la
+        // muestra repite entonces el último top
+        const bool procs = !adapt || adapt->proc_due(s.t_ns);
+        if (procs) {
+            table.refresh();
+            select_top(table, top);
+            if (cgroups.active()) {
+                cgroups.refresh();
+                cgroups.top(ncg, s.cgroups);
+            }
+            s.top.clear();
+            for (const ProcInfo *p : top) {
+                ProcSample ps{ static_cast<long long>(p->pid), p->cpu_pct, p->rss_kb, {} };
+                std::snprintf(ps.name, sizeof(ps.name), "%s", p->name);
+                s.top.push_back(ps);
+            }
+            if (table.tasks()) select_threads(table, kThreadsPerTask, top, s.threads);
+            if (snap) fill_snapshot(table, *snap);
+        }
+        if (adapt) {
+            adapt->observe(s, procs, table.changes());
+            s.period_ms = static_cast<uint32_t>(adapt->period_ms());
+            s.burst = adapt->burst();
+            tick.set_period(static_cast<int64_t>(s.period_ms) * 1000000LL);
+        }
+        ring.push(s);
+
+        tick.wait_next();
+    }
+}
+
+// -------------------------- Estadísticas --------------------------
+// Estadísticas de frecuencia por núcleo en memoria constante: EWMA e
+// histogramas de ventana deslizante (por defecto 10 s, 1 min y 5 min) con
+// cubetas fijas de 25 MHz. Cada ventana
+// se parte en kSlices rodajas: una muestra suma en la rodaja actual y en el
+// total de la ventana, O(1) por núcleo; al caducar una rodaja se resta
+// entera del total, con un coste que depende del número de núcleos y no del
+// de muestras. La ventana cubre entre 9/10 y 10/10 de su duración. Los
+// percentiles, el mínimo y el máximo salen del total, con la resolución de
+// una cubeta. Todo en estructura de arrays por ventana:
+// slices[rodaja][cpu][cubeta] y total[cpu][cubeta]; la EWMA en un array
+// por cpu.
+//
+// La alimentan los consumidores (TUI, exportador) con cada muestra del ring
+// y en el orden de t_ns, así funciona igual en vivo y con --replay.
+class FreqStats {
+public:
+    static const int kBucketMhz = 25;
+    static const size_t kBuckets = 256;    // la última recoge >= 6375 MHz
+    static const size_t kSlices = 10;
+
+    FreqStats() { set_windows({ 10000000000LL, 60000000000LL, 300000000000LL }); }
+    FreqStats(const FreqStats&) = delete;
+    FreqStats& operator=(const FreqStats&) = delete;
+
+    void set_windows(const std::vector<int64_t>& windows_ns) {
+        win_.clear();
+        for (int64_t w : windows_ns) {
+            Window x;
+            x.slice_ns = std::max<int64_t>(w / kSlices, 1);
+            const int64_t s = w / 1000000000LL;
+            if (s > 0 && s % 3600 == 0) x.label = std::to_string(s / 3600) + "h";
+            else if (s > 0 && s % 60 == 0) x.label = std::to_string(s / 60) + "m";
+            else if (s > 0) x.label = std::to_string(s) + "s";
+            else x.label = std::to_string(w / 1000000) + "ms";
+            win_.push_back(std::move(x));
+        }
+        ewma_tau_ns_ = windows_ns.empty() ? 10000000000LL : *std::min_element(windows_ns.begin(), windows_ns.end());
+        ncpu_ = 0;
+    }
+
+    size_t windows() const { return win_.size(); }
+    const char *window_label(size_t w) const { return win_[w].label.c_str(); }
+    size_t ncpu() const { return ncpu_; }
+
+    float ewma(size_t cpu) const { return ewma_[cpu]; }     // -1 = sin datos
+    uint32_t count(size_t w, size_t cpu) const { return win_[w].count[cpu]; }
+    const uint32_t *hist(size_t w, size_t cpu) const { return &win_[w].total[cpu * kBuckets]; }
+    static double bucket_upper_mhz(size_t b) { return double(b + 1) * kBucketMhz; }
+
+    // Cuantil q (0..1) del núcleo cpu en la ventana w, en el centro de su
+    // cubeta. -1 si la ventana está vacía.
+    double quantile(size_t w, size_t cpu, double q) const {
+        const uint32_t n = count(w, cpu);
+        if (n == 0) return -1;
+        const uint64_t rank = std::min<uint64_t>(static_cast<uint64_t>(q * n), n - 1);
+        const uint32_t *h = hist(w, cpu);
+        uint64_t acc = 0;
+        for (size_t b = 0; b < kBuckets; ++b) {
+            acc += h[b];
+            if (acc > rank) return (b + 0.5) * kBucketMhz;
+        }
+        return (kBuckets - 0.5) * kBucketMhz;
+    }
+
+    // Mínimo y máximo del núcleo cpu en la ventana w: centro de la primera
+    // y de la última cubeta con muestras. -1 si la ventana está vacía.
+    double window_min(size_t w, size_t cpu) const {
+        const uint32_t *h = hist(w, cpu);
+        for (size_t b = 0; b < kBuckets; ++b)
+            if (h[b]) return (b + 0.5) * kBucketMhz;
+        return -1;
+    }
+    double window_max(size_t w, size_t cpu) const {
+        const uint32_t *h = hist(w, cpu);
+        for (size_t b = kBuckets; b-- > 0;)
+            if (h[b]) return (b + 0.5) * kBucketMhz;
+        return -1;
+    }
+
+    void add(const Sample& s) {
+        if (s.mhz.size() != ncpu_) reset(s.mhz.size());
+        const double alpha = last_t_ && s.t_ns > last_t_
+            ? 1.0 - std::exp(-double(s.t_ns - last_t_) / double(ewma_tau_ns_)) : 1.0;
+        last_t_ = s.t_ns;
+        for (Window& w : win_) advance(w, s.t_ns);
+
+        for (size_t c = 0; c < ncpu_; ++c) {
+            const double mhz = s.mhz[c];
+            if (mhz <= 0) continue;
+            const float f = static_cast<float>(mhz);
+            ewma_[c] = ewma_[c] < 0 ? f : static_cast<float>(ewma_[c] + alpha * (f - ewma_[c]));
+            const size_t b = std::min<size_t>(static_cast<size_t>(mhz / kBucketMhz), kBuckets - 1);
+            for (Window& w : win_) {
+                const size_t slot = static_cast<size_t>(w.cur % kSlices);
+                ++w.slices[(slot * ncpu_ + c) * kBuckets + b];
+                ++w.total[c * kBuckets + b];
+                ++w.count[c];
+            }
+        }
+    }
+
+    // Alimenta con las muestras del ring posteriores a la última vista (las
+    // ya sobrescritas se pierden) y deja en out la más reciente. false si
+    // no había nada nuevo.
+    bool catch_up(const SampleRing& ring, Sample& out) {
+        const uint64_t head = ring.head();
+        if (head == 0 || head == fed_) return false;
+        uint64_t id = fed_ ? fed_ + 1 : head;
+        if (head - id >= ring.capacity()) id = head - ring.capacity() + 1;
+        bool got = false;
+        for (; id <= head; ++id)
+            if (ring.read(id, out)) { add(out); got = true; }
+        fed_ = head;
+        return got;
+    }
+
+private:
+    struct Window {
+        std::string label;
+        int64_t slice_ns = 0;
+        int64_t cur = -1;                // rodaja absoluta (t_ns / slice_ns) de la última muestra
+        std::vector<uint32_t> slices;    // [kSlices][ncpu][kBuckets]; u16 no llega a 2 h a 100 Hz
+        std::vector<uint32_t> total;     // [ncpu][kBuckets]
+        std::vector<uint32_t> count;     // [ncpu]
+    };
+
+    void reset(size_t ncpu) {
+        ncpu_ = ncpu;
+        ewma_.assign(ncpu, -1.0f);
+        for (Window& w : win_) {
+            w.cur = -1;
+            w.slices.assign(kSlices * ncpu * kBuckets, 0);
+            w.total.assign(ncpu * kBuckets, 0);
+            w.count.assign(ncpu, 0);
+        }
+    }
+
+    // Caduca las rodajas que quedan fuera de la ventana al llegar a t.
+    void advance(Window& w, int64_t t) {
+        const int64_t n = t / w.slice_ns;
+        if (n == w.cur) return;
+        if (w.cur < 0 || n < w.cur || n - w.cur >= static_cast<int64_t>(kSlices)) {
+            // primera muestra, reloj hacia atrás (otra grabación) o hueco mayor que la ventana
+            std::fill(w.slices.begin(), w.slices.end(), 0);
+            std::fill(w.total.begin(), w.total.end(), 0);
+            std::fill(w.count.begin(), w.count.end(), 0);
+            w.cur = n;
+            return;
+        }
+        const size_t stride = ncpu_ * kBuckets;
+        while (w.cur < n) {
+            ++w.cur;
+            uint32_t *sl = &w.slices[static_cast<size_t>(w.cur % kSlices) * stride];
+            for (size_t c = 0; c < ncpu_; ++c)
+                for (size_t b = 0; b < kBuckets; ++b) {
+                    const uint32_t v = sl[c * kBuckets + b];
+                    if (!v) continue;
+                    w.total[c * kBuckets + b] -= v;
+                    w.count[c] -= v;
+                    sl[c * kBuckets + b] = 0;
+                }
+        }
+    }
+
+    std::vector<Window> win_;
+    size_t ncpu_ = 0;
+    int64_t ewma_tau_ns_ = 10000000000LL;
+    int64_t last_t_ = 0;
+    uint64_t fed_ = 0;
+    std::vector<float> ewma_;
+};
+
+// "10s,1m,5m" -> ns; sufijos ms, s, m, h (sin sufijo, segundos).
+static bool parse_windows(const std::string& spec, std::vector<int64_t>& out) {
+    out.clear();
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        char *end = nullptr;
+        const double v = std::strtod(item.c_str(), &end);
+        const std::string unit = end;
+        double mult = 1e9;
+        if (unit == "ms") mult = 1e6;
+        else if (unit == "m") mult = 60e9;
+        else if (unit == "h") mult = 3600e9;
+        else if (!unit.empty() && unit != "s") return false;
+        if (!(v > 0)) return false;
+        out.push_back(static_cast<int64_t>(v * mult));
+    }
+    return !out.empty() && out.size() <= 8;
+}
+
+// ---------------------------- Topología ---------------------------
+// Se lee una vez al arrancar: paquete, nodo NUMA, dominio L3 y núcleo
+// físico (hermanos SMT) de cada CPU lógica. Con eso la TUI y el exportador
+// muestran min/avg/max de frecuencia y uso por grupo en lugar de cientos
+// de líneas [CPU i].
+enum TopoLevel { kLevelPackage, kLevelNode, kLevelL3, kLevelCore, kLevelCount, kLevelCpu = kLevelCount };
+static const char *const kLevelNames[] = { "package", "node", "l3", "smt" };
+static const char *const kLevelTags[] = { "PKG", "NODO", "L3", "CORE" };
+
+struct CpuTopology {
+    size_t ncpu = 0;
+    std::vector<int> level_id[kLevelCount];   // por id de CPU; -1 = desconocido
+
+    // Por nivel: CPUs ordenadas por grupo; el grupo g ocupa
+    // cpus[start[g], start[g + 1]) y se llama ids[g].
+    struct Groups { std::vector<int> ids; std::vector<uint32_t> start, cpus; };
+    Groups groups[kLevelCount];
+
+    void resize(size_t n) {
+        ncpu = n;
+        for (auto& v : level_id) v.assign(n, -1);
+    }
+
+    void build_groups() {
+        std::vector<std::pair<int, uint32_t>> order;
+        for (int l = 0; l < kLevelCount; ++l) {
+            order.clear();
+            for (size_t c = 0; c < ncpu; ++c)
+                if (level_id[l][c] >= 0) order.emplace_back(level_id[l][c], static_cast<uint32_t>(c));
+            std::sort(order.begin(), order.end());
+            Groups& g = groups[l];
+            g.ids.clear(); g.start.clear(); g.cpus.clear();
+            for (const auto& e : order) {
+                if (g.ids.empty() || g.ids.back() != e.first) {
+                    g.ids.push_back(e.first);
+                    g.start.push_back(static_cast<uint32_t>(g.cpus.size()));
+                }
+                g.cpus.push_back(e.second);
+            }
+            g.start.push_back(static_cast<uint32_t>(g.cpus.size()));
+        }
+    }
+};
+
+static int parse_level(const std::string& s) {
+    if (s == "cpu") return kLevelCpu;
+    for (int l = 0; l < kLevelCount; ++l)
+        if (s == kLevelNames[l]) return l;
+    return -1;
+}
+
+#ifdef _WIN32
+// Índice lineal de la CPU (grupo, bit) sumando los grupos anteriores.
+static int win_cpu_index(WORD group, DWORD bit) {
+    int base = 0;
+    for (WORD g = 0; g < group; ++g) base += static_cast<int>(GetActiveProcessorCount(g));
+    return base + static_cast<int>(bit);
+}
+
+static void win_mark(CpuTopology& t, int level, const GROUP_AFFINITY& ga, int id) {
+    for (DWORD b = 0; b < sizeof(KAFFINITY) * 8; ++b) {
+        if (!(ga.Mask & (KAFFINITY(1) << b))) continue;
+        const int c = win_cpu_index(ga.Group, b);
+        if (c >= 0 && static_cast<size_t>(c) < t.ncpu) t.level_id[level][c] = id;
+    }
+}
+
+static int win_first_cpu(const GROUP_AFFINITY& ga) {
+    for (DWORD b = 0; b < sizeof(KAFFINITY) * 8; ++b)
+        if (ga.Mask & (KAFFINITY(1) << b)) return win_cpu_index(ga.Group, b);
+    return -1;
+}
+
+// GetLogicalProcessorInformationEx(RelationAll): paquetes, núcleos,
+// nodos NUMA y cachés L3 con sus máscaras de afinidad por grupo.
+static bool load_topology(CpuTopology& t) {
+    DWORD len = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &len);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) return false;
+    std::vector<BYTE> buf(len);
+    auto *first = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buf.data());
+    if (!GetLogicalProcessorInformationEx(RelationAll, first, &len)) return false;
+
+    t.resize(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+    int pkg = 0;
+    for (DWORD off = 0; off < len; ) {
+        auto *info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buf.data() + off);
+        switch (info->Relationship) {
+        case RelationProcessorPackage:
+            for (WORD g = 0; g < info->Processor.GroupCount; ++g)
+                win_mark(t, kLevelPackage, info->Processor.GroupMask[g], pkg);
+            ++pkg;
+            break;
+        case RelationProcessorCore:
+            win_mark(t, kLevelCore, info->Processor.GroupMask[0], win_first_cpu(info->Processor.GroupMask[0]));
+            break;
+        case RelationNumaNode:
+            win_mark(t, kLevelNode, info->NumaNode.GroupMask, static_cast<int>(info->NumaNode.NodeNumber));
+            break;
+        case RelationCache:
+            if (info->Cache.Level == 3)
+                win_mark(t, kLevelL3, info->Cache.GroupMask, win_first_cpu(info->Cache.GroupMask));
+            break;
+        default:
+            break;
+        }
+        off += info->Size;
+    }
+    t.build_groups();
+    return true;
+}
+#else
+// cpuN/topology/{physical_package_id,core_id}, cpuN/cache/index*/ (nivel 3)
+// y nodeN/cpulist, para las CPUs presentes del CpuSet de root. Una CPU
+// offline puede no tener topology/: cuenta en el paquete 0 y sin núcleo.
+static bool load_topology(CpuTopology& t, const std::string& root = kSysCpuRoot,
+                          const std::string& node_root = "/sys/devices/system/node") {
+    const std::vector<int>& cpus = CpuSet::at(root).present();
+    if (cpus.empty()) return false;
+    t.resize(cpus.back() + 1);
+
+    std::vector<int> list;
+    std::map<long, int> core_key;  // (paquete, core_id) -> primera CPU
+    for (int c : cpus) {
+        const std::string base = root + "/cpu" + std::to_string(c);
+        const long pkg = read_int_file(base + "/topology/physical_package_id", -1);
+        const long core = read_int_file(base + "/topology/core_id", -1);
+        t.level_id[kLevelPackage][c] = static_cast<int>(pkg < 0 ? 0 : pkg);
+        if (core >= 0) {
+            auto it = core_key.emplace((std::max(pkg, 0L) << 20) | core, c).first;
+            t.level_id[kLevelCore][c] = it->second;
+        }
+        for (int idx = 0; idx < 8; ++idx) {
+            const std::string cache = base + "/cache/index" + std::to_string(idx);
+            const long level = read_int_file(cache + "/level", -1);
+            if (level < 0) break;
+            if (level != 3) continue;
+            long id = read_int_file(cache + "/id", -1);
+            if (id < 0) {
+                // sin "id": el dominio se identifica por su primera CPU
+                char buf[4096];
+                ssize_t n = read_small_file((cache + "/shared_cpu_list").c_str(), buf, sizeof(buf));
+                if (n > 0) parse_cpulist(buf, buf + n, list);
+                id = (n > 0 && !list.empty()) ? list.front() : c;
+            }
+            t.level_id[kLevelL3][c] = static_cast<int>(id);
+            break;
+        }
+    }
+
+    std::vector<int> nodes;
+    list_numbered_dirs(node_root, "node", nodes);
+    for (int node : nodes) {
+        char buf[4096];
+        ssize_t n = read_small_file((node_root + "/node" + std::to_string(node) + "/cpulist").c_str(),
+                                    buf, sizeof(buf));
+        if (n <= 0) continue;
+        parse_cpulist(buf, buf + n, list);
+        for (int c : list)
+            if (c >= 0 && static_cast<size_t>(c) < t.ncpu) t.level_id[kLevelNode][c] = node;
+    }
+    if (nodes.empty())
+        for (int c : cpus) t.level_id[kLevelNode][c] = 0;  // kernel sin NUMA
+
+    t.build_groups();
+    return true;
+}
+#endif
+
+// min/avg/max por grupo; -1 = ninguna CPU del grupo tiene dato.
+struct GroupStat { int id; uint32_t ncpu; float fmin, favg, fmax, umin, uavg, umax; };
+
+// Reordena la muestra por grupo en arrays contiguos (SoA: MHz y uso por
+// separado) y reduce cada rango con bucles sin saltos que el compilador
+// puede vectorizar.
+class TopoAggregator {
+public:
+    void run(const CpuTopology& t, int level, const Sample& s, std::vector<GroupStat>& out) {
+        out.clear();
+        if (level < 0 || level >= kLevelCount) return;
+        const CpuTopology::Groups& g = t.groups[level];
+        const size_t n = g.cpus.size();
+        f_.resize(n);
+        u_.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            const uint32_t c = g.cpus[k];
+            f_[k] = c < s.mhz.size() ? static_cast<float>(s.mhz[c]) : -1.0f;
+            u_[k] = c < s.util.size() ? static_cast<float>(s.util[c].busy) : -1.0f;
+        }
+        for (size_t i = 0; i < g.ids.size(); ++i) {
+            const uint32_t a = g.start[i], b = g.start[i + 1];
+            GroupStat st{ g.ids[i], b - a, 0, 0, 0, 0, 0, 0 };
+            reduce(f_.data() + a, b - a, st.fmin, st.favg, st.fmax);
+            reduce(u_.data() + a, b - a, st.umin, st.uavg, st.umax);
+            out.push_back(st);
+        }
+    }
+
+private:
+    static void reduce(const float *v, size_t n, float& mn, float& avg, float& mx) {
+        const float inf = std::numeric_limits<float>::infinity();
+        float lo = inf, hi = -inf, sum = 0.0f;
+        int cnt = 0;
+        for (size_t k = 0; k < n; ++k) {
+            const bool ok = v[k] >= 0.0f;
+            lo = std::min(lo, ok ? v[k] : inf);
+            hi = std::max(hi, ok ? v[k] : -inf);
+            sum += ok ? v[k] : 0.0f;
+            cnt += ok;
+        }
+        if (cnt == 0) { mn = avg = mx = -1.0f; return; }
+        mn = lo; mx = hi; avg = sum / cnt;
+    }
+
+    std::vector<float> f_, u_;
+};
+
+// ---------------------------- Grabación ---------------------------
+// Formato binario de --record/--replay (little endian). Cabecera de 16
+// bytes: "INXREC1\0", u16 versión, u16 reservado, u32 reservado. Después,
+// frames: u8 tipo ('K' clave, 'D' delta), varint longitud y el contenido:
+//   varint t_ns (absoluto en 'K', delta con el frame anterior en 'D')
+//   varint ncpu
+//   MHz:  'K' -> u32 por núcleo en unidades de 10 kHz (0 = N/D)
+//         'D' -> bitmap de núcleos cambiados + u16 zigzag del delta por
+//                núcleo cambiado (0xFFFF = escape, sigue el u32 absoluto)
+//   uso:  'K' -> 4 x u8 (busy, iowait, irq, steal) en % (255 = N/D)
+//         'D' -> u8 0 (sin cambios) o 1 + bitmap de núcleos cambiados + sus
+//                4 bytes. El uso es la media desde el último envío y se
+//                envía como mucho cada kUtilNs: a 100 Hz /proc/stat cuenta
+//                en ticks enteros y el de cada frame es casi todo ruido.
+//   varint nproc, bitmap de puestos del top cambiados y por cada uno u8
+//   flags y, en este orden, lo que marquen: 16 = varint j, el proceso
+//   que iba en el puesto j del frame anterior (el top solo se reordenó),
+//   1 = varint pid, 4 = varint CPU en centésimas de %, 8 = varint RSS kB,
+//   2 = u8 longitud + nombre (la primera vez tras un 'K' o si el comm
+//   cambió, p. ej. tras un exec). CPU y RSS solo se reenvían si se mueven
+//   más de kTopCpuStep o de 1/128.
+//   Secciones opcionales al final (un lector que no las conozca las ignora):
+//   'T' + varint ncpu + u8 0 + por núcleo u8 °C (255 = N/D), u8 paquete
+//   (255 = N/D) y u8 flags de throttling (--thermal); en un 'D' con el
+//   mismo ncpu, u8 1 + bitmap + solo los núcleos cambiados, y sin 'T' si no
+//   cambió ninguno.
+// Cada kKeyInterval frames, o si cambia el número de núcleos, va un 'K'.
+// Fuera de los frames de muestra, 'H' lleva el nombre del host (--agent).
+// La versión 1 mandaba el uso de cada frame sin el u8 previo, un u8 flags
+// por puesto del top sin bitmap (0 = igual; el flag 1 incluía CPU y RSS) y
+// cada frame repetía 'T' entero (sin 'T' = vacío).
+static const char kRecMagic[8] = { 'I', 'N', 'X', 'R', 'E', 'C', '1', '\0' };
+static const uint16_t kRecVersion = 2;
+static const size_t kRecHeaderSize = 16;
+
+static void put_u8(std::string& b, uint8_t v) { b.push_back(static_cast<char>(v)); }
+static void put_u16(std::string& b, uint16_t v) { put_u8(b, v & 0xFF); put_u8(b, v >> 8); }
+static void put_u32(std::string& b, uint32_t v) { put_u16(b, v & 0xFFFF); put_u16(b, v >> 16); }
+static void put_varint(std::string& b, uint64_t v) {
+    while (v >= 0x80) { put_u8(b, static_cast<uint8_t>(v | 0x80)); v >>= 7; }
+    put_u8(b, static_cast<uint8_t>(v));
+}
+
+// Lector acotado de bytes; ok pasa a false si se sale del rango.
+struct ByteReader {
+    const uint8_t *p, *end;
+    bool ok = true;
+
+    uint8_t u8() {
+        if (p >= end) { ok = false; return 0; }
+        return *p++;
+    }
+    uint16_t u16() { uint16_t lo = u8(); return static_cast<uint16_t>(lo | (u8() << 8)); }
+    uint32_t u32() { uint32_t lo = u16(); return lo | (static_cast<uint32_t>(u16()) << 16); }
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t c = u8();
+            v |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+    const uint8_t *bytes(size_t n) {
+        if (static_cast<size_t>(end - p) < n) { ok = false; return nullptr; }
+        const uint8_t *q = p;
+        p += n;
+        return q;
+    }
+};
+
+static uint32_t mhz_to_units(double mhz) { return mhz > 0 ? static_cast<uint32_t>(mhz * 100.0 + 0.5) : 0; }
+static double units_to_mhz(uint32_t u) { return u ? u / 100.0 : -1.0; }
+static uint8_t pct_to_u8(double pct) {
+    if (pct < 0) return 255;
+    return static_cast<uint8_t>(std::min(100.0, pct) + 0.5);
+}
+static double u8_to_pct(uint8_t v) { return v == 255 ? -1.0 : v; }
+
+// Estado compartido por codificador y decodificador: lo último enviado.
+struct RecState {
+    int64_t t_ns = 0;
+    std::vector<uint32_t> mhz;                  // unidades de 10 kHz
+    std::vector<std::array<uint8_t, 4>> util;
+    std::vector<std::array<uint8_t, 3>> thermal;
+    struct Proc { long long pid; uint64_t cpu; uint64_t rss; std::string name; };
+    std::vector<Proc> top;
+    size_t since_key = 0;
+    bool valid = false;
+};
+
+static std::array<uint8_t, 3> thermal_bytes(const CoreThermal& t) {
+    return { t.temp_c < 0 ? uint8_t(255) : static_cast<uint8_t>(std::min(254.0f, t.temp_c + 0.5f)),
+             t.pkg < 0 || t.pkg > 254 ? uint8_t(255) : static_cast<uint8_t>(t.pkg),
+             t.throttle };
+}
+
+// Bitmap de n bits en b a partir de bm; bit i si changed(i).
+template <typename F>
+static void put_bitmap(std::string& b, size_t n, F changed) {
+    const size_t bm = b.size();
+    b.append((n + 7) / 8, '\0');
+    for (size_t i = 0; i < n; ++i)
+        if (changed(i)) b[bm + i / 8] = static_cast<char>(b[bm + i / 8] | (1 << (i % 8)));
+}
+
+class RecordEncoder {
+public:
+    static const size_t kKeyInterval = 1024;
+    static constexpr int64_t kUtilNs = 1000000000LL;   // uso: como mucho 1 Hz
+    static const uint64_t kTopCpuStep = 25;             // 0,25 puntos de CPU
+
+    // Añade a out el frame de s (clave o delta según el estado).
+    void encode(const Sample& s, std::string& out) {
+        const size_t n = s.mhz.size();
+        const bool key = !st_.valid || st_.since_key >= kKeyInterval || n != st_.mhz.size();
+        if (key) { names_.clear(); st_.since_key = 0; }
+        ++st_.since_key;
+
+        body_.clear();
+        put_varint(body_, key ? static_cast<uint64_t>(s.t_ns) : static_cast<uint64_t>(s.t_ns - st_.t_ns));
+        put_varint(body_, n);
+
+        cur_mhz_.resize(n);
+        for (size_t i = 0; i < n; ++i) cur_mhz_[i] = mhz_to_units(s.mhz[i]);
+        const bool send_util = accumulate_util(s, key);
+
+        if (key) {
+            for (size_t i = 0; i < n; ++i) put_u32(body_, cur_mhz_[i]);
+            for (size_t i = 0; i < n; ++i)
+                for (uint8_t b : cur_util_[i]) put_u8(body_, b);
+        } else {
+            put_bitmap(body_, n, [&](size_t i) { return cur_mhz_[i] != st_.mhz[i]; });
+            for (size_t i = 0; i < n; ++i) {
+                if (cur_mhz_[i] == st_.mhz[i]) continue;
+                const int64_t d = static_cast<int64_t>(cur_mhz_[i]) - st_.mhz[i];
+                if (d >= -32767 && d <= 32767) {
+                    put_u16(body_, static_cast<uint16_t>(d >= 0 ? d * 2 : -d * 2 - 1));
+                } else {
+                    put_u16(body_, 0xFFFF);
+                    put_u32(body_, cur_mhz_[i]);
+                }
+            }
+            bool any = false;
+            for (size_t i = 0; send_util && i < n && !any; ++i) any = cur_util_[i] != st_.util[i];
+            put_u8(body_, any);
+            if (any) {
+                put_bitmap(body_, n, [&](size_t i) { return cur_util_[i] != st_.util[i]; });
+                for (size_t i = 0; i < n; ++i)
+                    if (cur_util_[i] != st_.util[i])
+                        for (uint8_t b : cur_util_[i]) put_u8(body_, b);
+            }
+        }
+        if (key || send_util) st_.util = cur_util_;
+
+        put_varint(body_, s.top.size());
+        prev_top_ = st_.top;
+        rank_.clear();
+        for (size_t j = 0; j < prev_top_.size(); ++j) rank_.emplace(prev_top_[j].pid, j);
+        st_.top.resize(s.top.size(), RecState::Proc{ -1, 0, 0, {} });
+        const size_t tbm = body_.size();
+        body_.append((s.top.size() + 7) / 8, '\0');
+        for (size_t r = 0; r < s.top.size(); ++r) {
+            const ProcSample& p = s.top[r];
+            RecState::Proc& prev = st_.top[r];
+            const uint64_t cpu = static_cast<uint64_t>(std::max(0.0, p.cpu_pct) * 100.0 + 0.5);
+            const size_t len = strnlen(p.name, sizeof(p.name) - 1);
+            uint8_t flags = 0;
+            size_t from = 0;
+            if (key) {
+                flags = 1 | 4 | 8;
+            } else if (r >= prev_top_.size() || prev_top_[r].pid != p.pid) {
+                auto it = rank_.find(p.pid);
+                if (it != rank_.end()) { flags = 16; from = it->second; prev = prev_top_[from]; }
+                else flags = 1 | 4 | 8;
+            }
+            if ((cpu > prev.cpu ? cpu - prev.cpu : prev.cpu - cpu) >= kTopCpuStep || (cpu == 0) != (prev.cpu == 0))
+                flags |= 4;
+            if ((p.rss_kb > prev.rss ? p.rss_kb - prev.rss : prev.rss - p.rss_kb) > prev.rss / 128) flags |= 8;
+            std::string& name = names_[p.pid];
+            if (name.size() != len || name.compare(0, len, p.name, len) != 0) {
+                name.assign(p.name, len);
+                flags |= 2;
+            }
+            if (!flags) continue;
+            body_[tbm + r / 8] = static_cast<char>(body_[tbm + r / 8] | (1 << (r % 8)));
+            put_u8(body_, flags);
+            if (flags & 16) put_varint(body_, from);
+            if (flags & 1) { put_varint(body_, static_cast<uint64_t>(p.pid)); prev.pid = p.pid; }
+            if (flags & 4) { put_varint(body_, cpu); prev.cpu = cpu; }
+            if (flags & 8) { put_varint(body_, p.rss_kb); prev.rss = p.rss_kb; }
+            if (flags & 2) {
+                put_u8(body_, static_cast<uint8_t>(len));
+                body_.append(p.name, len);
+            }
+        }
+
+        const size_t nt = s.thermal.size();
+        cur_thermal_.resize(nt);
+        for (size_t i = 0; i < nt; ++i) cur_thermal_[i] = thermal_bytes(s.thermal[i]);
+        const bool full = key || nt != st_.thermal.size();
+        if (full ? nt > 0 || !st_.thermal.empty() : cur_thermal_ != st_.thermal) {
+            put_u8(body_, 'T');
+            put_varint(body_, nt);
+            put_u8(body_, !full);
+            if (!full) put_bitmap(body_, nt, [&](size_t i) { return cur_thermal_[i] != st_.thermal[i]; });
+            for (size_t i = 0; i < nt; ++i)
+                if (full || cur_thermal_[i] != st_.thermal[i])
+                    for (uint8_t b : cur_thermal_[i]) put_u8(body_, b);
+            st_.thermal.swap(cur_thermal_);
+        }
+
+        put_u8(out, key ? 'K' : 'D');
+        put_varint(out, body_.size());
+        out += body_;
+
+        st_.t_ns = s.t_ns;
+        st_.mhz.swap(cur_mhz_);
+        st_.valid = true;
+    }
+
+private:
+    // Suma el uso de s a la media en curso; true si toca enviarla (queda
+    // en cur_util_). En un 'K' siempre.
+    bool accumulate_util(const Sample& s, bool key) {
+        const size_t n = s.mhz.size();
+        if (util_sum_.size() != n) {
+            util_sum_.assign(n, {});
+            util_cnt_.assign(n, {});
+        }
+        for (size_t i = 0; i < n; ++i) {
+            const CoreUtil u = i < s.util.size() ? s.util[i] : CoreUtil{};
+            const double v[4] = { u.busy, u.iowait, u.irq, u.steal };
+            for (int k = 0; k < 4; ++k)
+                if (v[k] >= 0) { util_sum_[i][k] += static_cast<float>(v[k]); ++util_cnt_[i][k]; }
+        }
+        if (!key && s.t_ns - util_t_ < kUtilNs) return false;
+        cur_util_.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            for (int k = 0; k < 4; ++k)
+                cur_util_[i][k] = pct_to_u8(util_cnt_[i][k] ? util_sum_[i][k] / util_cnt_[i][k] : -1.0);
+        util_sum_.assign(n, {});
+        util_cnt_.assign(n, {});
+        util_t_ = s.t_ns;
+        return true;
+    }
+
+    RecState st_;
+    std::string body_;
+    std::vector<uint32_t> cur_mhz_;
+    std::vector<std::array<uint8_t, 4>> cur_util_;
+    std::vector<std::array<uint8_t, 3>> cur_thermal_;
+    std::vector<std::array<float, 4>> util_sum_;
+    std::vector<std::array<uint32_t, 4>> util_cnt_;
+    int64_t util_t_ = 0;
+    std::unordered_map<long long, std::string> names_;   // último nombre escrito por PID
+    std::vector<RecState::Proc> prev_top_;
+    std::unordered_map<long long, size_t> rank_;         // PID -> puesto en prev_top_
+};
+
+class RecordDecoder {
+public:
+    explicit RecordDecoder(uint16_t version = kRecVersion) : version_(version) {}
+    void set_version(uint16_t v) { version_ = v; }
+
+    // Decodifica el frame en [p, end); false si está corrupto o incompleto.
+    bool decode(uint8_t kind, const uint8_t *p, const uint8_t *end, Sample& out) {
+        if (kind != 'K' && kind != 'D') return false;
+        const bool key = kind == 'K';
+        if (!key && !st_.valid) return false;
+        ByteReader r{ p, end };
+
+        const uint64_t t = r.varint();
+        st_.t_ns = key ? static_cast<int64_t>(t) : st_.t_ns + static_cast<int64_t>(t);
+        const size_t n = r.varint();
+        if (!r.ok || (!key && n != st_.mhz.size()) || n > (1u << 20)) return false;
+
+        if (key) {
+            names_.clear();
+            st_.mhz.resize(n);
+            st_.util.resize(n);
+            for (size_t i = 0; i < n; ++i) st_.mhz[i] = r.u32();
+            for (size_t i = 0; i < n; ++i)
+                for (uint8_t& b : st_.util[i]) b = r.u8();
+        } else {
+            const uint8_t *bm = r.bytes((n + 7) / 8);
+            if (!bm) return false;
+            for (size_t i = 0; i < n; ++i) {
+                if (!(bm[i / 8] & (1 << (i % 8)))) continue;
+                const uint16_t z = r.u16();
+                if (z == 0xFFFF) st_.mhz[i] = r.u32();
+                else st_.mhz[i] = static_cast<uint32_t>(static_cast<int64_t>(st_.mhz[i]) +
+                                                        ((z & 1) ? -static_cast<int64_t>((z + 1) / 2) : z / 2));
+            }
+            if (version_ < 2 || r.u8()) {
+                const uint8_t *ubm = r.bytes((n + 7) / 8);
+                if (!ubm) return false;
+                for (size_t i = 0; i < n; ++i) {
+                    if (!(ubm[i / 8] & (1 << (i % 8)))) continue;
+                    for (uint8_t& b : st_.util[i]) b = r.u8();
+                }
+            }
+        }
+
+        const size_t np = r.varint();
+        if (!r.ok || np > 4096) return false;
+        prev_top_ = st_.top;
+        st_.top.resize(np, RecState::Proc{ -1, 0, 0, {} });
+        const uint8_t *tbm = version_ >= 2 ? r.bytes((np + 7) / 8) : nullptr;
+        if (version_ >= 2 && !tbm) return false;
+        for (size_t k = 0; k < np; ++k) {
+            if (tbm && !(tbm[k / 8] & (1 << (k % 8)))) continue;
+            uint8_t flags = r.u8();
+            if (flags == 0) continue;
+            if (version_ < 2) flags |= 4 | 8;   // v1: el pid siempre con CPU y RSS
+            RecState::Proc& pr = st_.top[k];
+            if (flags & 16) {
+                const uint64_t j = r.varint();
+                if (j >= prev_top_.size()) return false;
+                pr = prev_top_[j];
+            }
+            if (flags & 1) pr.pid = static_cast<long long>(r.varint());
+            if (flags & 4) pr.cpu = r.varint();
+            if (flags & 8) pr.rss = r.varint();
+            if (flags & 2) {
+                const size_t len = r.u8();
+                const uint8_t *nm = r.bytes(len);
+                if (!nm) return false;
+                names_[pr.pid].assign(reinterpret_cast<const char*>(nm), len);
+            }
+            auto it = names_.find(pr.pid);
+            pr.name = it != names_.end() ? it->second : std::string("?");
+        }
+        if (!r.ok) return false;
+
+        if (version_ < 2) st_.thermal.clear();
+        if (r.p < r.end && *r.p == 'T') {
+            r.u8();
+            const size_t nt = r.varint();
+            if (!r.ok || nt > (1u << 20)) return false;
+            const uint8_t *hbm = nullptr;
+            if (version_ >= 2 && r.u8()) {
+                if (nt != st_.thermal.size() || !(hbm = r.bytes((nt + 7) / 8))) return false;
+            } else {
+                st_.thermal.resize(nt);
+            }
+            for (size_t i = 0; i < nt; ++i)
+                if (!hbm || (hbm[i / 8] & (1 << (i % 8))))
+                    for (uint8_t& b : st_.thermal[i]) b = r.u8();
+            if (!r.ok) return false;
+        }
+        st_.valid = true;
+
+        out.thermal.resize(st_.thermal.size());
+        for (size_t i = 0; i < st_.thermal.size(); ++i) {
+            CoreThermal& t = out.thermal[i];
+            t = CoreThermal{};
+            t.temp_c = st_.thermal[i][0] == 255 ? -1.0f : st_.thermal[i][0];
+            t.pkg = st_.thermal[i][1] == 255 ? -1 : st_.thermal[i][1];
+            t.throttle = st_.thermal[i][2];
+        }
+        out.t_ns = st_.t_ns;
+        out.mhz.resize(n);
+        out.util.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            out.mhz[i] = units_to_mhz(st_.mhz[i]);
+            out.util[i] = CoreUtil{ u8_to_pct(st_.util[i][0]), u8_to_pct(st_.util[i][1]),
+                                    u8_to_pct(st_.util[i][2]), u8_to_pct(st_.util[i][3]) };
+        }
+        out.top.resize(np);
+        for (size_t k = 0; k < np; ++k) {
+            const RecState::Proc& pr = st_.top[k];
+            ProcSample& ps = out.top[k];
+            ps.pid = pr.pid;
+            ps.cpu_pct = pr.cpu / 100.0;
+            ps.rss_kb = pr.rss;
+            std::snprintf(ps.name, sizeof(ps.name), "%s", pr.name.c_str());
+        }
+        return true;
+    }
+
+private:
+    RecState st_;
+    std::unordered_map<long long, std::string> names_;
+    std::vector<RecState::Proc> prev_top_;
+    uint16_t version_;
+};
+
+// --record: consume el ring en orden y añade frames al fichero. Escribe con
+// un buffer grande y vacía como mucho cada segundo.
+class Recorder {
+public:
+    bool open(const char *path) {
+        if (FILE *f = std::fopen(path, "rb")) {
+            char hdr[kRecHeaderSize];
+            const size_t n = std::fread(hdr, 1, sizeof(hdr), f);
+            std::fclose(f);
+            if (n > 0 && (n < sizeof(hdr) || std::memcmp(hdr, kRecMagic, sizeof(kRecMagic)) != 0)) {
+                std::fprintf(stderr, "%s no es una grabación de inexcpu\n", path);
+                return false;
+            }
+            ByteReader r{ reinterpret_cast<const uint8_t*>(hdr) + sizeof(kRecMagic),
+                          reinterpret_cast<const uint8_t*>(hdr) + n };
+            const uint16_t v = r.u16();
+            if (n > 0 && v != kRecVersion) {
+                std::fprintf(stderr, "%s es una grabación de la versión %u: no se puede añadir a ella\n", path, v);
+                return false;
+            }
+        }
+        f_ = std::fopen(path, "ab");
+        if (!f_) { std::perror(path); return false; }
+        std::setvbuf(f_, nullptr, _IOFBF, 1 << 20);
+        std::fseek(f_, 0, SEEK_END);
+        if (std::ftell(f_) == 0) {
+            std::string hdr(kRecMagic, sizeof(kRecMagic));
+            put_u16(hdr, kRecVersion);
+            put_u16(hdr, 0);
+            put_u32(hdr, 0);
+            std::fwrite(hdr.data(), 1, hdr.size(), f_);
+        }
+        return true;
+    }
+    ~Recorder() { if (f_) std::fclose(f_); }
+
+    void run(const SampleRing& ring) {
+        Sample s;
+        uint64_t next = ring.head() + 1;
+        int64_t last_flush = monotonic_ns();
+        while (!g_stop) {
+            ring.wait(next - 1, std::chrono::milliseconds(1000));
+            while (next <= ring.head()) {
+                if (!ring.read(next, s)) { next = ring.head(); continue; }  // nos adelantaron
+                buf_.clear();
+                enc_.encode(s, buf_);
+                std::fwrite(buf_.data(), 1, buf_.size(), f_);
+                ++next;
+            }
+            if (monotonic_ns() - last_flush >= 1000000000LL) {
+                std::fflush(f_);
+                last_flush = monotonic_ns();
+            }
+        }
+        std::fflush(f_);
+    }
+
+private:
+    FILE *f_ = nullptr;
+    RecordEncoder enc_;
+    std::string buf_;
+};
+
+// --replay: mapea la grabación en memoria y la recorre frame a frame.
+class RecordReader {
+public:
+    ~RecordReader() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+        if (data_) ::munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+    }
+
+    bool open(const char *path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file_, &sz) || sz.QuadPart < static_cast<LONGLONG>(kRecHeaderSize)) return false;
+        size_ = static_cast<size_t>(sz.QuadPart);
+        map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!map_) return false;
+        data_ = static_cast<const uint8_t*>(MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat sb;
+        if (::fstat(fd, &sb) < 0 || sb.st_size < static_cast<off_t>(kRecHeaderSize)) { ::close(fd); return false; }
+        size_ = static_cast<size_t>(sb.st_size);
+        void *m = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) return false;
+        ::madvise(m, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const uint8_t*>(m);
+#endif
+        if (!data_ || std::memcmp(data_, kRecMagic, sizeof(kRecMagic)) != 0) return false;
+        ByteReader r{ data_ + sizeof(kRecMagic), data_ + kRecHeaderSize };
+        dec_.set_version(r.u16());
+        pos_ = kRecHeaderSize;
+        return true;
+    }
+
+    // Siguiente muestra; false al final o si el resto está truncado.
+    bool next(Sample& out) {
+        while (pos_ < size_) {
+            ByteReader r{ data_ + pos_, data_ + size_ };
+            const uint8_t kind = r.u8();
+            const uint64_t len = r.varint();
+            if (!r.ok || len > static_cast<uint64_t>(r.end - r.p)) return false;
+            const uint8_t *body = r.p;
+            pos_ = static_cast<size_t>(body + len - data_);
+            if (dec_.decode(kind, body, body + len, out)) { out.seq = ++seq_; return true; }
+        }
+        return false;
+    }
+
+    // Mayor número de núcleos de la grabación (para dimensionar el ring).
+    size_t max_cpus() const {
+        size_t best = 0, pos = kRecHeaderSize;
+        while (pos < size_) {
+            ByteReader r{ data_ + pos, data_ + size_ };
+            r.u8();
+            const uint64_t len = r.varint();
+            if (!r.ok || len > static_cast<uint64_t>(r.end - r.p)) break;
+            ByteReader b{ r.p, r.p + len };
+            b.varint();
+            const size_t n = b.varint();
+            if (b.ok) best = std::max(best, n);
+            pos = static_cast<size_t>(r.p + len - data_);
+        }
+        return best;
+    }
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0, pos_ = 0;
+    uint64_t seq_ = 0;
+    RecordDecoder dec_;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE, map_ = nullptr;
+#endif
+};
+
+// Productor alternativo: reproduce la grabación al ritmo original.
+static void replay_loop(RecordReader& reader, SampleRing& ring) {
+    Sample s;
+    int64_t t0 = 0, wall0 = 0;
+    while (!g_stop && reader.next(s)) {
+        if (wall0 == 0) { t0 = s.t_ns; wall0 = monotonic_ns(); }
+        const int64_t wait = wall0 + (s.t_ns - t0) - monotonic_ns();
+        if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<int64_t>(wait, 5000000000LL)));
+        ring.push(s);
+    }
+}
+
+// --------------------------- Exportador ---------------------------
+// --listen [host]:puerto sirve GET /metrics en formato OpenMetrics. El
+// cuerpo se genera una vez por muestra (no por scrape) en uno de dos
+// buffers y se envía tal cual con writev; un buffer que aún se está
+// enviando a un cliente lento no se reutiliza hasta que termine.
+#ifdef _WIN32
+using socket_t = SOCKET;
+static const socket_t kBadSocket = INVALID_SOCKET;
+static void close_socket(socket_t s) { closesocket(s); }
+static int poll_sockets(pollfd *fds, size_t n, int ms) { return WSAPoll(fds, static_cast<ULONG>(n), ms); }
+static void set_nonblocking(socket_t s) { u_long on = 1; ioctlsocket(s, FIONBIO, &on); }
+static bool would_block() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+static bool connect_pending() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+static const int kSendFlags = 0;
+#else
+using socket_t = int;
+static const socket_t kBadSocket = -1;
+static void close_socket(socket_t s) { ::close(s); }
+static int poll_sockets(pollfd *fds, size_t n, int ms) { return ::poll(fds, n, ms); }
+static void set_nonblocking(socket_t s) { ::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL) | O_NONBLOCK); }
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+static bool connect_pending() { return errno == EINPROGRESS; }
+static const int kSendFlags = MSG_NOSIGNAL;
+#endif
+
+// Separa "[host]:puerto", "host:puerto" o ":puerto".
+static bool split_host_port(const std::string& spec, std::string& host, std::string& port) {
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos || colon + 1 == spec.size()) return false;
+    host = spec.substr(0, colon);
+    port = spec.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    return true;
+}
+
+// Socket no bloqueante escuchando en spec ("[host]:puerto"); opt es la
+// opción que lo pidió, para los mensajes de error.
+static socket_t listen_tcp(const char *spec, const char *opt, int backlog) {
+    std::string host, port;
+    if (!split_host_port(spec, host, port)) {
+        std::fprintf(stderr, "%s espera [host]:puerto, p. ej. :9105\n", opt);
+        return kBadSocket;
+    }
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0) {
+        std::fprintf(stderr, "%s: dirección no válida: %s\n", opt, spec);
+        return kBadSocket;
+    }
+    socket_t out = kBadSocket;
+    for (addrinfo *ai = res; ai && out == kBadSocket; ai = ai->ai_next) {
+        socket_t fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == kBadSocket) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+        if (::bind(fd, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0 && ::listen(fd, backlog) == 0) {
+            set_nonblocking(fd);
+            out = fd;
+        } else {
+            close_socket(fd);
+        }
+    }
+    freeaddrinfo(res);
+    if (out == kBadSocket) std::fprintf(stderr, "%s: no se pudo escuchar en %s\n", opt, spec);
+    return out;
+}
+
+// Conexión TCP no bloqueante a host:port esperando como mucho timeout_ms.
+static socket_t connect_tcp(const std::string& host, const std::string& port, int timeout_ms) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return kBadSocket;
+    socket_t out = kBadSocket;
+    for (addrinfo *ai = res; ai && out == kBadSocket; ai = ai->ai_next) {
+        socket_t fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == kBadSocket) continue;
+        set_nonblocking(fd);
+        bool ok = ::connect(fd, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0;
+        if (!ok && connect_pending()) {
+            pollfd p{ fd, POLLOUT, 0 };
+            int err = 0;
+            socklen_t len = sizeof(err);
+            ok = poll_sockets(&p, 1, timeout_ms) == 1 &&
+                 getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &len) == 0 && err == 0;
+        }
+        if (ok) out = fd;
+        else close_socket(fd);
+    }
+    freeaddrinfo(res);
+    if (out != kBadSocket) {
+        int on = 1;
+        setsockopt(out, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+    }
+    return out;
+}
+
+// Escapa \, " y salto de línea en valores de etiqueta.
+static void append_label(std::string& out, const char *s) {
+    for (; *s; ++s) {
+        if (*s == '\\' || *s == '"') { out += '\\'; out += *s; }
+        else if (*s == '\n') out += "\\n";
+        else out += *s;
+    }
+}
+
+class MetricsExporter {
+public:
+    explicit MetricsExporter(const CpuTopology *topo = nullptr) : topo_(topo) {}
+    void set_windows(const std::vector<int64_t>& windows_ns) { freq_.set_windows(windows_ns); }
+    ~MetricsExporter() {
+        for (Conn& c : conns_) close_socket(c.fd);
+        if (listen_fd_ != kBadSocket) close_socket(listen_fd_);
+    }
+
+    bool listen(const char *spec) {
+        listen_fd_ = listen_tcp(spec, "--listen", 64);
+        return listen_fd_ != kBadSocket;
+    }
+
+    void run(const SampleRing& ring) {
+        std::vector<pollfd> pfds;
+        while (!g_stop) {
+            // el cuerpo se formatea al llegar un scrape, no a cada muestra:
+            // con las ráfagas de --adaptive serían 100 renders por segundo
+            if (freq_.catch_up(ring, last_)) stale_ = true;
+
+            pfds.clear();
+            pfds.push_back(pollfd{ listen_fd_, POLLIN, 0 });
+            for (const Conn& c : conns_) pfds.push_back(pollfd{ c.fd, static_cast<short>(c.body ? POLLOUT : POLLIN), 0 });
+            if (poll_sockets(pfds.data(), pfds.size(), 200) < 0) continue;
+
+            if (pfds[0].revents & POLLIN) accept_clients();
+            const int64_t now = monotonic_ns();
+            for (size_t i = 0, k = 1; i < conns_.size(); ++k) {
+                Conn& c = conns_[i];
+                bool keep = now - c.since < kClientTimeoutNs;
+                if (keep && k < pfds.size() && pfds[k].revents)
+                    keep = c.body ? send_more(c) : read_request(c);
+                if (keep) { ++i; continue; }
+                close_socket(c.fd);
+                conns_[i] = std::move(conns_.back());
+                conns_.pop_back();
+            }
+        }
+    }
+
+private:
+    struct Conn {
+        socket_t fd;
+        int64_t since;
+        std::string in;
+        std::string head;                        // cabeceras HTTP
+        std::shared_ptr<const std::string> body; // cuerpo compartido; nulo = leyendo
+        size_t off = 0;                          // bytes enviados de head + body
+    };
+    static const int64_t kClientTimeoutNs = 5000000000LL;
+    static const size_t kMaxClients = 64;
+    static const size_t kHistMerge = 10;   // cubetas de 25 MHz por cada le exportado (250 MHz)
+    static const size_t kHistEdges = 24;   // le = 250..6000 MHz, y +Inf
+
+    void render(const Sample& s) {
+        // reusar el buffer de reserva solo si ningún cliente lo está enviando
+        if (!spare_ || spare_.use_count() > 1) spare_ = std::make_shared<std::string>();
+        std::string& b = *spare_;
+        b.clear();
+        const SelfCost& me = self_.sample();
+        b += "# TYPE inexcpu_self_cpu_seconds counter\n"
+             "# HELP inexcpu_self_cpu_seconds CPU consumida por el propio monitor.\n";
+        append_fmt(b, "inexcpu_self_cpu_seconds_total %.3f\n", me.cpu_s);
+        b += "# TYPE inexcpu_self_resident_bytes gauge\n"
+             "# HELP inexcpu_self_resident_bytes RSS del propio monitor.\n";
+        append_fmt(b, "inexcpu_self_resident_bytes %llu\n", me.rss_kb * 1024);
+        b += "# TYPE inexcpu_self_io_syscalls counter\n"
+             "# HELP inexcpu_self_io_syscalls Llamadas al sistema de lectura y escritura del monitor.\n";
+        append_fmt(b, "inexcpu_self_io_syscalls_total %llu\n", me.syscalls);
+        if (s.period_ms) {
+            b += "# TYPE inexcpu_sampling_interval_seconds gauge\n"
+                 "# HELP inexcpu_sampling_interval_seconds Periodo de muestreo en curso (--adaptive).\n";
+            append_fmt(b, "inexcpu_sampling_interval_seconds %.3f\n", s.period_ms / 1000.0);
+            b += "# TYPE inexcpu_sampling_burst gauge\n"
+                 "# HELP inexcpu_sampling_burst 1 durante una ráfaga de --adaptive.\n";
+            append_fmt(b, "inexcpu_sampling_burst %d\n", s.burst ? 1 : 0);
+        }
+        b += "# TYPE inexcpu_cpu_frequency_mhz gauge\n"
+             "# HELP inexcpu_cpu_frequency_mhz Frecuencia actual por CPU lógica.\n";
+        for (size_t i = 0; i < s.mhz.size(); ++i)
+            if (s.mhz[i] > 0) append_fmt(b, "inexcpu_cpu_frequency_mhz{cpu=\"%zu\"} %.2f\n", i, s.mhz[i]);
+
+        b += "# TYPE inexcpu_cpu_utilization_ratio gauge\n"
+             "# HELP inexcpu_cpu_utilization_ratio Fracción del intervalo por CPU y modo.\n";
+        for (size_t i = 0; i < s.util.size(); ++i) {
+            const CoreUtil& u = s.util[i];
+            if (u.busy < 0) continue;
+            append_fmt(b, "inexcpu_cpu_utilization_ratio{cpu=\"%zu\",mode=\"busy\"} %.4f\n", i, u.busy / 100.0);
+            append_fmt(b, "inexcpu_cpu_utilization_ratio{cpu=\"%zu\",mode=\"iowait\"} %.4f\n", i, u.iowait / 100.0);
+            append_fmt(b, "inexcpu_cpu_utilization_ratio{cpu=\"%zu\",mode=\"irq\"} %.4f\n", i, u.irq / 100.0);
+            append_fmt(b, "inexcpu_cpu_utilization_ratio{cpu=\"%zu\",mode=\"steal\"} %.4f\n", i, u.steal / 100.0);
+        }
+
+        if (!s.hw.empty()) {
+            b += "# TYPE inexcpu_cpu_ipc gauge\n"
+                 "# HELP inexcpu_cpu_ipc Instrucciones por ciclo (--perf).\n";
+            for (size_t i = 0; i < s.hw.size(); ++i)
+                if (s.hw[i].ipc >= 0) append_fmt(b, "inexcpu_cpu_ipc{cpu=\"%zu\"} %.3f\n", i, s.hw[i].ipc);
+            b += "# TYPE inexcpu_cpu_stall_ratio gauge\n"
+                 "# HELP inexcpu_cpu_stall_ratio Ciclos parados en backend / ciclos (--perf).\n";
+            for (size_t i = 0; i < s.hw.size(); ++i)
+                if (s.hw[i].stall >= 0) append_fmt(b, "inexcpu_cpu_stall_ratio{cpu=\"%zu\"} %.4f\n", i, s.hw[i].stall);
+            b += "# TYPE inexcpu_cpu_llc_misses_per_kilo_instructions gauge\n"
+                 "# HELP inexcpu_cpu_llc_misses_per_kilo_instructions Fallos de LLC por mil instrucciones (--perf).\n";
+            for (size_t i = 0; i < s.hw.size(); ++i)
+                if (s.hw[i].mpki >= 0)
+                    append_fmt(b, "inexcpu_cpu_llc_misses_per_kilo_instructions{cpu=\"%zu\"} %.3f\n", i, s.hw[i].mpki);
+        }
+
+        b += "# TYPE inexcpu_process_cpu_percent gauge\n"
+             "# HELP inexcpu_process_cpu_percent CPU% de los procesos del top-N.\n";
+        for (size_t r = 0; r < s.top.size(); ++r) {
+            append_fmt(b, "inexcpu_process_cpu_percent{rank=\"%zu\",pid=\"%lld\",name=\"", r + 1, s.top[r].pid);
+            append_label(b, s.top[r].name);
+            append_fmt(b, "\"} %.2f\n", s.top[r].cpu_pct);
+        }
+        b += "# TYPE inexcpu_process_resident_bytes gauge\n"
+             "# HELP inexcpu_process_resident_bytes RSS de los procesos del top-N.\n";
+        for (size_t r = 0; r < s.top.size(); ++r) {
+            append_fmt(b, "inexcpu_process_resident_bytes{rank=\"%zu\",pid=\"%lld\",name=\"", r + 1, s.top[r].pid);
+            append_label(b, s.top[r].name);
+            append_fmt(b, "\"} %llu\n", s.top[r].rss_kb * 1024ull);
+        }
+        if (!s.threads.empty()) {
+            b += "# TYPE inexcpu_thread_cpu_percent gauge\n"
+                 "# HELP inexcpu_thread_cpu_percent CPU% de los hilos más activos de --tasks y la CPU donde corren.\n";
+            for (const ThreadSample& t : s.threads) {
+                append_fmt(b, "inexcpu_thread_cpu_percent{pid=\"%lld\",tid=\"%lld\",cpu=\"%d\",name=\"", t.pid, t.tid, t.cpu);
+                append_label(b, t.name);
+                append_fmt(b, "\"} %.2f\n", t.cpu_pct);
+            }
+            b += "# TYPE inexcpu_thread_context_switches_per_second gauge\n"
+                 "# HELP inexcpu_thread_context_switches_per_second Cambios de contexto por hilo de --tasks.\n";
+            for (const ThreadSample& t : s.threads) {
+                if (t.vcsw_s < 0) continue;
+                append_fmt(b, "inexcpu_thread_context_switches_per_second{pid=\"%lld\",tid=\"%lld\",kind=\"voluntary\"} %.1f\n",
+                           t.pid, t.tid, t.vcsw_s);
+                append_fmt(b, "inexcpu_thread_context_switches_per_second{pid=\"%lld\",tid=\"%lld\",kind=\"involuntary\"} %.1f\n",
+                           t.pid, t.tid, t.ivcsw_s);
+            }
+        }
+
+        if (!s.thermal.empty()) {
+            b += "# TYPE inexcpu_cpu_temperature_celsius gauge\n"
+                 "# HELP inexcpu_cpu_temperature_celsius Temperatura del núcleo de cada CPU (hwmon).\n";
+            for (size_t i = 0; i < s.thermal.size(); ++i)
+                if (s.thermal[i].temp_c >= 0)
+                    append_fmt(b, "inexcpu_cpu_temperature_celsius{cpu=\"%zu\"} %.1f\n", i, s.thermal[i].temp_c);
+            b += "# TYPE inexcpu_cpu_thermal_throttling gauge\n"
+                 "# HELP inexcpu_cpu_thermal_throttling 1 si el contador de throttling subió en el intervalo.\n";
+            for (size_t i = 0; i < s.thermal.size(); ++i) {
+                const uint8_t f = s.thermal[i].throttle;
+                append_fmt(b, "inexcpu_cpu_thermal_throttling{cpu=\"%zu\",scope=\"core\"} %d\n", i, (f & kThrottleCore) ? 1 : 0);
+                append_fmt(b, "inexcpu_cpu_thermal_throttling{cpu=\"%zu\",scope=\"package\"} %d\n", i, (f & kThrottlePkg) ? 1 : 0);
+            }
+            // por paquete: la primera CPU de cada uno
+            std::string temps, watts;
+            for (size_t i = 0; i < s.thermal.size(); ++i) {
+                const CoreThermal& t = s.thermal[i];
+                if (t.pkg < 0) continue;
+                bool seen = false;
+                for (size_t j = 0; j < i && !seen; ++j) seen = s.thermal[j].pkg == t.pkg;
+                if (seen) continue;
+                if (t.pkg_temp_c >= 0) append_fmt(temps, "inexcpu_package_temperature_celsius{package=\"%d\"} %.1f\n", t.pkg, t.pkg_temp_c);
+                if (t.pkg_watts >= 0) append_fmt(watts, "inexcpu_package_power_watts{package=\"%d\"} %.2f\n", t.pkg, t.pkg_watts);
+            }
+            b += "# TYPE inexcpu_package_temperature_celsius gauge\n"
+                 "# HELP inexcpu_package_temperature_celsius Temperatura del paquete (hwmon o thermal_zone).\n";
+            b += temps;
+            b += "# TYPE inexcpu_package_power_watts gauge\n"
+                 "# HELP inexcpu_package_power_watts Potencia del paquete según RAPL (energy_uj).\n";
+            b += watts;
+        }
+
+        if (!s.trans.empty()) {
+            b += "# TYPE inexcpu_cpu_frequency_transitions counter\n"
+                 "# HELP inexcpu_cpu_frequency_transitions Cambios de frecuencia (power:cpu_frequency).\n";
+            for (size_t i = 0; i < s.trans.size(); ++i)
+                append_fmt(b, "inexcpu_cpu_frequency_transitions_total{cpu=\"%zu\"} %u\n", i, s.trans[i].changes);
+            b += "# TYPE inexcpu_cpu_idle_entries counter\n"
+                 "# HELP inexcpu_cpu_idle_entries Entradas en idle (power:cpu_idle).\n";
+            for (size_t i = 0; i < s.trans.size(); ++i)
+                append_fmt(b, "inexcpu_cpu_idle_entries_total{cpu=\"%zu\"} %u\n", i, s.trans[i].idle);
+            b += "# TYPE inexcpu_cpu_frequency_last_change_seconds gauge\n"
+                 "# HELP inexcpu_cpu_frequency_last_change_seconds CLOCK_MONOTONIC del último cambio de frecuencia.\n";
+            for (size_t i = 0; i < s.trans.size(); ++i)
+                if (s.trans[i].last_ns)
+                    append_fmt(b, "inexcpu_cpu_frequency_last_change_seconds{cpu=\"%zu\"} %.6f\n", i, s.trans[i].last_ns / 1e9);
+        }
+
+        if (const size_t nc = freq_.ncpu()) {
+            b += "# TYPE inexcpu_cpu_frequency_ewma_mhz gauge\n"
+                 "# HELP inexcpu_cpu_frequency_ewma_mhz Media móvil exponencial de la frecuencia (constante: la ventana más corta).\n";
+            for (size_t i = 0; i < nc; ++i)
+                if (freq_.ewma(i) > 0) append_fmt(b, "inexcpu_cpu_frequency_ewma_mhz{cpu=\"%zu\"} %.2f\n", i, freq_.ewma(i));
+            b += "# TYPE inexcpu_cpu_frequency_min_mhz gauge\n"
+                 "# HELP inexcpu_cpu_frequency_min_mhz Frecuencia mínima por ventana (centro de cubeta de 25 MHz).\n";
+            for (size_t w = 0; w < freq_.windows(); ++w)
+                for (size_t i = 0; i < nc; ++i)
+                    if (freq_.count(w, i))
+                        append_fmt(b, "inexcpu_cpu_frequency_min_mhz{cpu=\"%zu\",window=\"%s\"} %.1f\n",
+                                   i, freq_.window_label(w), freq_.window_min(w, i));
+            b += "# TYPE inexcpu_cpu_frequency_max_mhz gauge\n"
+                 "# HELP inexcpu_cpu_frequency_max_mhz Frecuencia máxima por ventana (centro de cubeta de 25 MHz).\n";
+            for (size_t w = 0; w < freq_.windows(); ++w)
+                for (size_t i = 0; i < nc; ++i)
+                    if (freq_.count(w, i))
+                        append_fmt(b, "inexcpu_cpu_frequency_max_mhz{cpu=\"%zu\",window=\"%s\"} %.1f\n",
+                                   i, freq_.window_label(w), freq_.window_max(w, i));
+            b += "# TYPE inexcpu_cpu_frequency_quantile_mhz gauge\n"
+                 "# HELP inexcpu_cpu_frequency_quantile_mhz p50 y p99 de la frecuencia por ventana (centro de cubeta de 25 MHz).\n";
+            for (size_t w = 0; w < freq_.windows(); ++w)
+                for (size_t i = 0; i < nc; ++i) {
+                    if (!freq_.count(w, i)) continue;
+                    append_fmt(b, "inexcpu_cpu_frequency_quantile_mhz{cpu=\"%zu\",window=\"%s\",quantile=\"0.5\"} %.1f\n",
+                               i, freq_.window_label(w), freq_.quantile(w, i, 0.5));
+                    append_fmt(b, "inexcpu_cpu_frequency_quantile_mhz{cpu=\"%zu\",window=\"%s\",quantile=\"0.99\"} %.1f\n",
+                               i, freq_.window_label(w), freq_.quantile(w, i, 0.99));
+                }
+            // le fijos cada 250 MHz para todas las CPUs y ventanas, también
+            // sin datos: si el conjunto de series cambiara entre scrapes,
+            // Prometheus marcaría stale las que faltan. Las cubetas de 25 MHz
+            // se agrupan de diez en diez para no multiplicar las series.
+            b += "# TYPE inexcpu_cpu_frequency_window_mhz gaugehistogram\n"
+                 "# HELP inexcpu_cpu_frequency_window_mhz Histograma de la frecuencia en la ventana deslizante (cubetas de 250 MHz).\n";
+            for (size_t w = 0; w < freq_.windows(); ++w)
+                for (size_t i = 0; i < nc; ++i) {
+                    const uint32_t n = freq_.count(w, i);
+                    const uint32_t *h = freq_.hist(w, i);
+                    uint64_t acc = 0;
+                    for (size_t k = 0; k < kHistEdges; ++k) {
+                        for (size_t j = k * kHistMerge; j < (k + 1) * kHistMerge; ++j) acc += h[j];
+                        append_fmt(b, "inexcpu_cpu_frequency_window_mhz_bucket{cpu=\"%zu\",window=\"%s\",le=\"%.0f\"} %llu\n",
+                                   i, freq_.window_label(w), FreqStats::bucket_upper_mhz((k + 1) * kHistMerge - 1),
+                                   static_cast<unsigned long long>(acc));
+                    }
+                    append_fmt(b, "inexcpu_cpu_frequency_window_mhz_bucket{cpu=\"%zu\",window=\"%s\",le=\"+Inf\"} %u\n",
+                               i, freq_.window_label(w), n);
+                    append_fmt(b, "inexcpu_cpu_frequency_window_mhz_gcount{cpu=\"%zu\",window=\"%s\"} %u\n",
+                               i, freq_.window_label(w), n);
+                }
+        }
+
+        if (!s.cgroups.empty()) {
+            b += "# TYPE inexcpu_cgroup_cpu_usage_ratio gauge\n"
+                 "# HELP inexcpu_cgroup_cpu_usage_ratio CPUs usadas por el cgroup (1 = una CPU entera).\n";
+            for (const CgroupSample& g : s.cgroups) {
+                b += "inexcpu_cgroup_cpu_usage_ratio{cgroup=\"";
+                append_label(b, g.path);
+                append_fmt(b, "\"} %.4f\n", g.usage_pct / 100.0);
+            }
+            b += "# TYPE inexcpu_cgroup_cpu_throttled_ratio gauge\n"
+                 "# HELP inexcpu_cgroup_cpu_throttled_ratio Fracción del intervalo estrangulado por cpu.max.\n";
+            for (const CgroupSample& g : s.cgroups) {
+                b += "inexcpu_cgroup_cpu_throttled_ratio{cgroup=\"";
+                append_label(b, g.path);
+                append_fmt(b, "\"} %.4f\n", g.throttled_pct / 100.0);
+            }
+            b += "# TYPE inexcpu_cgroup_throttles_per_second gauge\n"
+                 "# HELP inexcpu_cgroup_throttles_per_second Periodos estrangulados por segundo (nr_throttled).\n";
+            for (const CgroupSample& g : s.cgroups) {
+                b += "inexcpu_cgroup_throttles_per_second{cgroup=\"";
+                append_label(b, g.path);
+                append_fmt(b, "\"} %.2f\n", g.throttles_s);
+            }
+        }
+
+        if (topo_) {
+            b += "# TYPE inexcpu_group_frequency_mhz gauge\n"
+                 "# HELP inexcpu_group_frequency_mhz Frecuencia min/avg/max por grupo de topología.\n";
+            for (int l = 0; l < kLevelCount; ++l) {
+                agg_.run(*topo_, l, s, stats_[l]);
+                for (const GroupStat& st : stats_[l]) {
+                    if (st.favg < 0) continue;
+                    for (int k = 0; k < 3; ++k)
+                        append_fmt(b, "inexcpu_group_frequency_mhz{level=\"%s\",group=\"%d\",stat=\"%s\"} %.2f\n",
+                                   kLevelNames[l], st.id, kStatNames[k], k == 0 ? st.fmin : k == 1 ? st.favg : st.fmax);
+                }
+            }
+            b += "# TYPE inexcpu_group_utilization_ratio gauge\n"
+                 "# HELP inexcpu_group_utilization_ratio Uso (busy) min/avg/max por grupo de topología.\n";
+            for (int l = 0; l < kLevelCount; ++l) {
+                for (const GroupStat& st : stats_[l]) {
+                    if (st.uavg < 0) continue;
+                    for (int k = 0; k < 3; ++k)
+                        append_fmt(b, "inexcpu_group_utilization_ratio{level=\"%s\",group=\"%d\",stat=\"%s\"} %.4f\n",
+                                   kLevelNames[l], st.id, kStatNames[k],
+                                   (k == 0 ? st.umin : k == 1 ? st.uavg : st.umax) / 100.0);
+                }
+            }
+        }
+
+        b += "# TYPE inexcpu_samples counter\n"
+             "# HELP inexcpu_samples Muestras tomadas desde el arranque.\n";
+        append_fmt(b, "inexcpu_samples_total %llu\n", static_cast<unsigned long long>(s.seq));
+        b += "# EOF\n";
+        std::swap(front_, spare_);
+    }
+
+    void accept_clients() {
+        for (;;) {
+            socket_t fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (fd == kBadSocket) return;
+            if (conns_.size() >= kMaxClients) { close_socket(fd); continue; }
+            set_nonblocking(fd);
+            conns_.push_back(Conn{ fd, monotonic_ns(), {}, {}, nullptr, 0 });
+        }
+    }
+
+    // Lee hasta tener la línea de petición; false = cerrar.
+    bool read_request(Conn& c) {
+        char buf[2048];
+        const int n = static_cast<int>(::recv(c.fd, buf, sizeof(buf), 0));
+        if (n == 0) return false;
+        if (n < 0) return would_block();
+        c.in.append(buf, n);
+        if (c.in.find("\r\n\r\n") == std::string::npos) return c.in.size() < 8192;
+
+        const bool metrics = c.in.rfind("GET /metrics ", 0) == 0 || c.in.rfind("GET /metrics?", 0) == 0;
+        if (metrics && stale_) { render(last_); stale_ = false; }
+        if (metrics && front_) {
+            c.body = front_;
+            append_fmt(c.head, "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                               "Content-Length: %zu\r\nConnection: close\r\n\r\n", c.body->size());
+        } else {
+            static const std::shared_ptr<const std::string> kEmpty = std::make_shared<const std::string>();
+            c.body = kEmpty;
+            c.head = metrics ? "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+                             : "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        }
+        return send_more(c);
+    }
+
+    // Envía cabeceras y cuerpo sin copiarlos; false = terminado o error.
+    bool send_more(Conn& c) {
+        for (;;) {
+            const size_t total = c.head.size() + c.body->size();
+            if (c.off >= total) return false;
+            const char *p1 = c.off < c.head.size() ? c.head.data() + c.off : nullptr;
+            const size_t l1 = p1 ? c.head.size() - c.off : 0;
+            const size_t boff = c.off > c.head.size() ? c.off - c.head.size() : 0;
+#ifdef _WIN32
+            WSABUF iov[2] = { { static_cast<ULONG>(l1), const_cast<char*>(p1) },
+                              { static_cast<ULONG>(c.body->size() - boff), const_cast<char*>(c.body->data() + boff) } };
+            DWORD sent = 0;
+            if (WSASend(c.fd, l1 ? iov : iov + 1, l1 ? 2 : 1, &sent, 0, nullptr, nullptr) != 0)
+                return would_block();
+            const long long n = sent;
+#else
+            iovec iov[2] = { { const_cast<char*>(p1), l1 },
+                             { const_cast<char*>(c.body->data() + boff), c.body->size() - boff } };
+            const ssize_t n = ::writev(c.fd, l1 ? iov : iov + 1, l1 ? 2 : 1);
+            if (n < 0) return would_block();
+#endif
+            c.off += static_cast<size_t>(n);
+        }
+    }
+
+    static constexpr const char *kStatNames[3] = { "min", "avg", "max" };
+
+    const CpuTopology *topo_;
+    FreqStats freq_;
+    SelfMeter self_;
+    TopoAggregator agg_;
+    std::vector<GroupStat> stats_[kLevelCount];
+    socket_t listen_fd_ = kBadSocket;
+    std::vector<Conn> conns_;
+    std::shared_ptr<std::string> front_, spare_;
+    Sample last_;          // última muestra del ring
+    bool stale_ = false;   // front_ no refleja last_
+};
+
+// ----------------------------- Salida -----------------------------
+// --format json|csv|text: las muestras van a stdout como filas para otros
+// programas en lugar de la TUI. json = una línea JSON por muestra (CPUs,
+// top de procesos, hilos de --tasks y cgroups); csv = una fila por CPU y
+// muestra, con cabecera; text = pares clave=valor por CPU y por proceso.
+// Todo se formatea con std::to_chars en un buffer fijo que se vuelca de una
+// vez cuando pasa de kFlushBytes o cada kFlushNs, así que a 100 Hz con
+// muchos núcleos el coste es formatear, no escribir.
+enum OutputFormat { kOutTui, kOutJson, kOutCsv, kOutText };
+
+class RowWriter {
+public:
+    explicit RowWriter(FILE *f) : f_(f) {}
+    RowWriter(const RowWriter&) = delete;
+    RowWriter& operator=(const RowWriter&) = delete;
+    ~RowWriter() { flush(); }
+
+    size_t size() const { return n_; }
+    bool failed() const { return failed_; }
+
+    void raw(std::string_view s) {
+        if (n_ + s.size() > sizeof(buf_)) flush();
+        if (s.size() > sizeof(buf_)) { write(s.data(), s.size()); return; }
+        std::memcpy(buf_ + n_, s.data(), s.size());
+        n_ += s.size();
+    }
+    void ch(char c) {
+        if (n_ == sizeof(buf_)) flush();
+        buf_[n_++] = c;
+    }
+    template <class Int> void num(Int v) {
+        room(24);
+        n_ = std::to_chars(buf_ + n_, buf_ + sizeof(buf_), v).ptr - buf_;
+    }
+    void fixed(double v, int prec) {
+        room(48);
+        auto r = std::to_chars(buf_ + n_, buf_ + sizeof(buf_), v, std::chars_format::fixed, prec);
+        if (r.ec == std::errc()) n_ = r.ptr - buf_;
+        else raw("0");
+    }
+    // v si es >= 0; si no, null (N/D).
+    void opt(double v, int prec, std::string_view null = "null") {
+        if (v >= 0) fixed(v, prec);
+        else raw(null);
+    }
+    // Cadena JSON entre comillas.
+    void json(const char *s) {
+        ch('"');
+        for (; *s; ++s) {
+            const unsigned char c = static_cast<unsigned char>(*s);
+            if (c == '"' || c == '\\') { ch('\\'); ch(static_cast<char>(c)); }
+            else if (c < 0x20) { raw("\\u00"); ch("0123456789abcdef"[c >> 4]); ch("0123456789abcdef"[c & 15]); }
+            else ch(static_cast<char>(c));
+        }
+        ch('"');
+    }
+    // Campo CSV/texto: entre comillas (dobladas) si lleva separadores.
+    void quoted(const char *s, char sep) {
+        if (!std::strpbrk(s, "\"\n") && !std::strchr(s, sep)) { raw(s); return; }
+        ch('"');
+        for (; *s; ++s) {
+            if (*s == '"') ch('"');
+            ch(*s == '\n' ? ' ' : *s);
+        }
+        ch('"');
+    }
+
+    void flush() {
+        if (n_) write(buf_, n_);
+        n_ = 0;
+        if (!failed_ && std::fflush(f_) != 0) failed_ = true;
+    }
+
+private:
+    void room(size_t k) { if (n_ + k > sizeof(buf_)) flush(); }
+    void write(const char *p, size_t k) {
+        if (!failed_ && std::fwrite(p, 1, k, f_) != k) failed_ = true;   // p. ej. EPIPE
+    }
+
+    FILE *f_;
+    char buf_[64 * 1024];
+    size_t n_ = 0;
+    bool failed_ = false;
+};
+
+class SampleWriter {
+public:
+    static const size_t kFlushBytes = 48 * 1024;
+    static constexpr int64_t kFlushNs = 100000000LL;     // 100 ms
+
+    // count: muestras a escribir antes de parar (0 = sin límite). En vivo
+    // la primera muestra no tiene deltas (uso, CPU%) y se salta.
+    SampleWriter(int format, uint64_t count, bool live)
+        : format_(format), count_(count), skip_first_(live), out_(stdout) {
+        if (live) {
+            const int64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            epoch_off_ns_ = wall - monotonic_ns();
+        }
+    }
+    SampleWriter(const SampleWriter&) = delete;
+    SampleWriter& operator=(const SampleWriter&) = delete;
+
+    // Hasta g_stop o hasta completar count; con count, pone g_stop al acabar.
+    void run(const SampleRing& ring) {
+        Sample s;
+        uint64_t next = ring.head() + 1;
+        int64_t last_flush = monotonic_ns();
+        if (format_ == kOutCsv)
+            out_.raw(epoch_off_ns_ ? "time,t_s,seq,cpu,mhz,busy_pct,iowait_pct,irq_pct,steal_pct,ipc,temp_c,throttle\n"
+                                   : "t_s,seq,cpu,mhz,busy_pct,iowait_pct,irq_pct,steal_pct,ipc,temp_c,throttle\n");
+        while (!g_stop) {
+            ring.wait(next - 1, std::chrono::milliseconds(1000));
+            while (next <= ring.head() && !g_stop) {
+                if (!ring.read(next, s)) { next = ring.head(); continue; }  // nos adelantaron
+                ++next;
+                if (skip_first_) { skip_first_ = false; continue; }
+                write(s);
+                if (count_ && ++written_ >= count_) g_stop = true;
+            }
+            const int64_t now = monotonic_ns();
+            if (out_.size() >= kFlushBytes || now - last_flush >= kFlushNs || g_stop) {
+                out_.flush();
+                last_flush = now;
+            }
+            if (out_.failed()) g_stop = true;   // stdout cerrado
+        }
+        out_.flush();
+    }
+
+private:
+    void write(const Sample& s) {
+        switch (format_) {
+        case kOutJson: write_json(s); break;
+        case kOutCsv: write_csv(s); break;
+        default: write_text(s); break;
+        }
+    }
+
+    void time_fields(const Sample& s, char sep, const char *k_time, const char *k_t) {
+        if (epoch_off_ns_) {
+            out_.raw(k_time);
+            out_.fixed((s.t_ns + epoch_off_ns_) / 1e9, 3);
+            out_.ch(sep);
+        }
+        out_.raw(k_t);
+        out_.fixed(s.t_ns / 1e9, 3);
+    }
+
+    void write_json(const Sample& s) {
+        out_.ch('{');
+        time_fields(s, ',', "\"time\":", "\"t\":");
+        out_.raw(",\"seq\":");
+        out_.num(s.seq);
+        if (s.period_ms) {
+            out_.raw(",\"period_ms\":");
+            out_.num(s.period_ms);
+            out_.raw(s.burst ? ",\"burst\":true" : ",\"burst\":false");
+        }
+        out_.raw(",\"cpus\":[");
+        for (size_t i = 0; i < s.mhz.size(); ++i) {
+            out_.raw(i ? ",{\"cpu\":" : "{\"cpu\":");
+            out_.num(i);
+            out_.raw(",\"mhz\":");
+            out_.opt(s.mhz[i], 1);
+            if (i < s.util.size()) {
+                const CoreUtil& u = s.util[i];
+                out_.raw(",\"busy\":");
+                out_.opt(u.busy, 2);
+                out_.raw(",\"iowait\":");
+                out_.opt(u.iowait, 2);
+                out_.raw(",\"irq\":");
+                out_.opt(u.irq, 2);
+                out_.raw(",\"steal\":");
+                out_.opt(u.steal, 2);
+            }
+            if (i < s.hw.size()) {
+                out_.raw(",\"ipc\":");
+                out_.opt(s.hw[i].ipc, 3);
+            }
+            if (i < s.thermal.size()) {
+                out_.raw(",\"temp_c\":");
+                out_.opt(s.thermal[i].temp_c, 1);
+                out_.raw(",\"throttle\":");
+                out_.num(static_cast<unsigned>(s.thermal[i].throttle));
+            }
+            out_.ch('}');
+        }
+        out_.raw("],\"procs\":[");
+        for (size_t r = 0; r < s.top.size(); ++r) {
+            const ProcSample& p = s.top[r];
+            out_.raw(r ? ",{\"pid\":" : "{\"pid\":");
+            out_.num(p.pid);
+            out_.raw(",\"cpu_pct\":");
+            out_.fixed(p.cpu_pct, 2);
+            out_.raw(",\"rss_kb\":");
+            out_.num(p.rss_kb);
+            out_.raw(",\"name\":");
+            out_.json(p.name);
+            out_.ch('}');
+        }
+        out_.ch(']');
+        if (!s.threads.empty()) {
+            out_.raw(",\"threads\":[");
+            for (size_t r = 0; r < s.threads.size(); ++r) {
+                const ThreadSample& t = s.threads[r];
+                out_.raw(r ? ",{\"pid\":" : "{\"pid\":");
+                out_.num(t.pid);
+                out_.raw(",\"tid\":");
+                out_.num(t.tid);
+                out_.raw(",\"cpu_pct\":");
+                out_.fixed(t.cpu_pct, 2);
+                out_.raw(",\"cpu\":");
+                if (t.cpu >= 0) out_.num(t.cpu);
+                else out_.raw("null");
+                out_.raw(",\"vcsw_s\":");
+                out_.opt(t.vcsw_s, 1);
+                out_.raw(",\"ivcsw_s\":");
+                out_.opt(t.ivcsw_s, 1);
+                out_.raw(",\"name\":");
+                out_.json(t.name);
+                out_.ch('}');
+            }
+            out_.ch(']');
+        }
+        if (!s.cgroups.empty()) {
+            out_.raw(",\"cgroups\":[");
+            for (size_t r = 0; r < s.cgroups.size(); ++r) {
+                const CgroupSample& g = s.cgroups[r];
+                out_.raw(r ? ",{\"path\":" : "{\"path\":");
+                out_.json(g.path);
+                out_.raw(",\"usage_pct\":");
+                out_.fixed(g.usage_pct, 2);
+                out_.raw(",\"throttled_pct\":");
+                out_.fixed(g.throttled_pct, 2);
+                out_.ch('}');
+            }
+            out_.ch(']');
+        }
+        out_.raw("}\n");
+    }
+
+    void write_csv(const Sample& s) {
+        for (size_t i = 0; i < s.mhz.size(); ++i) {
+            if (epoch_off_ns_) {
+                out_.fixed((s.t_ns + epoch_off_ns_) / 1e9, 3);
+                out_.ch(',');
+            }
+            out_.fixed(s.t_ns / 1e9, 3);
+            out_.ch(',');
+            out_.num(s.seq);
+            out_.ch(',');
+            out_.num(i);
+            out_.ch(',');
+            out_.opt(s.mhz[i], 1, "");
+            const CoreUtil u = i < s.util.size() ? s.util[i] : CoreUtil{};
+            for (double v : { u.busy, u.iowait, u.irq, u.steal }) {
+                out_.ch(',');
+                out_.opt(v, 2, "");
+            }
+            out_.ch(',');
+            if (i < s.hw.size()) out_.opt(s.hw[i].ipc, 3, "");
+            out_.ch(',');
+            if (i < s.thermal.size()) out_.opt(s.thermal[i].temp_c, 1, "");
+            out_.ch(',');
+            if (i < s.thermal.size()) out_.num(static_cast<unsigned>(s.thermal[i].throttle));
+            out_.ch('\n');
+        }
+    }
+
+    void write_text(const Sample& s) {
+        for (size_t i = 0; i < s.mhz.size(); ++i) {
+            time_fields(s, ' ', "time=", "t=");
+            out_.raw(" cpu=");
+            out_.num(i);
+            out_.raw(" mhz=");
+            out_.opt(s.mhz[i], 1, "-");
+            if (i < s.util.size() && s.util[i].busy >= 0) {
+                out_.raw(" busy=");
+                out_.fixed(s.util[i].busy, 2);
+                out_.raw(" iowait=");
+                out_.fixed(s.util[i].iowait, 2);
+                out_.raw(" irq=");
+                out_.fixed(s.util[i].irq, 2);
+                out_.raw(" steal=");
+                out_.fixed(s.util[i].steal, 2);
+            }
+            if (i < s.thermal.size() && s.thermal[i].temp_c >= 0) {
+                out_.raw(" temp_c=");
+                out_.fixed(s.thermal[i].temp_c, 1);
+            }
+            out_.ch('\n');
+        }
+        for (const ProcSample& p : s.top) {
+            time_fields(s, ' ', "time=", "t=");
+            out_.raw(" pid=");
+            out_.num(p.pid);
+            out_.raw(" cpu_pct=");
+            out_.fixed(p.cpu_pct, 2);
+            out_.raw(" rss_kb=");
+            out_.num(p.rss_kb);
+            out_.raw(" name=");
+            out_.quoted(p.name, ' ');
+            out_.ch('\n');
+        }
+    }
+
+    const int format_;
+    const uint64_t count_;
+    uint64_t written_ = 0;
+    bool skip_first_;
+    int64_t epoch_off_ns_ = 0;       // hora Unix - monotónico; 0 = sin hora (replay)
+    RowWriter out_;
+};
+
+static int parse_format(const std::string& s) {
+    if (s == "json") return kOutJson;
+    if (s == "csv") return kOutCsv;
+    if (s == "text") return kOutText;
+    return -1;
+}
+
+// ---------------------------- Pantalla ---------------------------
+// Renderer arma el frame completo en un buffer reservado, lo compara línea
+// a línea con el anterior y envía solo las líneas cambiadas (posicionando
+// el cursor con ANSI) en un único write(). Sustituye a system("clear").
+class Renderer {
+public:
+    // emit = false: arma y compara frames sin escribir (para --bench).
+    explicit Renderer(bool emit = true) : emit_(emit) {
+        cur_.reserve(64 * 1024);
+        prev_.reserve(64 * 1024);
+        out_.reserve(64 * 1024);
+#ifdef _WIN32
+        out_handle_ = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (GetConsoleMode(out_handle_, &mode))
+            SetConsoleMode(out_handle_, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#endif
+    }
+    ~Renderer() {
+        // reactivar autowrap y dejar el cursor debajo del último frame
+        out_.clear();
+        append_fmt(out_, "\x1b[%zu;1H\x1b[?7h", shown_ + 1);
+        write_all(out_);
+    }
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    void begin() { cur_.clear(); }
+
+    // Añade texto con formato printf al frame actual.
+    void add(const char *fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        append_vfmt(cur_, fmt, ap);
+        va_end(ap);
+    }
+
+    // Diff contra el frame anterior y un único write() con los cambios.
+    void present() {
+        int rows = 0;
+        terminal_rows(rows);
+        if (rows != rows_) { rows_ = rows; full_ = true; }  // redimensionado
+
+        split_lines(cur_, cur_lines_);
+        // el último renglón queda libre para que el cursor no haga scroll
+        size_t n = cur_lines_.size() - 1;
+        if (rows_ > 1 && n > static_cast<size_t>(rows_ - 1)) n = rows_ - 1;
+
+        out_.clear();
+        if (full_) out_ += "\x1b[?7l\x1b[H\x1b[2J";  // sin autowrap: una línea = una fila
+        for (size_t i = 0; i < n; ++i) {
+            const char *line = cur_.data() + cur_lines_[i];
+            size_t len = cur_lines_[i + 1] - cur_lines_[i] - 1;
+            if (!full_ && i + 1 < prev_lines_.size() && i < shown_) {
+                size_t plen = prev_lines_[i + 1] - prev_lines_[i] - 1;
+                if (plen == len && std::memcmp(prev_.data() + prev_lines_[i], line, len) == 0)
+                    continue;
+            }
+            append_fmt(out_, "\x1b[%zu;1H", i + 1);
+            out_.append(line, len);
+            out_ += "\x1b[K";
+        }
+        if (n < shown_ && !full_) append_fmt(out_, "\x1b[%zu;1H\x1b[J", n + 1);
+        append_fmt(out_, "\x1b[%zu;1H", n + 1);
+        write_all(out_);
+
+        shown_ = n;
+        full_ = false;
+        std::swap(cur_, prev_);
+        std::swap(cur_lines_, prev_lines_);
+    }
+
+    // Filas del terminal (24 si no se sabe).
+    int height() {
+        int rows = 0;
+        terminal_rows(rows);
+        return rows > 0 ? rows : 24;
+    }
+
+private:
+    // Offsets de inicio de cada línea, más uno final (fin + 1).
+    static void split_lines(const std::string& s, std::vector<size_t>& lines) {
+        lines.clear();
+        size_t pos = 0;
+        while (pos < s.size()) {
+            lines.push_back(pos);
+            const void *nl = std::memchr(s.data() + pos, '\n', s.size() - pos);
+            pos = nl ? static_cast<const char*>(nl) - s.data() + 1 : s.size() + 1;
+        }
+        lines.push_back(pos);
+    }
+
+    void terminal_rows(int& rows) {
+#ifdef _WIN32
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (GetConsoleScreenBufferInfo(out_handle_, &csbi))
+            rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+#else
+        struct winsize ws;
+        if (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) rows = ws.ws_row;
+#endif
+    }
 
-// ---------------------- Frecuencia por núcleo -------------------
+    void write_all(const std::string& s) {
+        if (!emit_) return;
 #ifdef _WIN32
-// Windows: usar CallNtPowerInformation(ProcessorInformation)
-// Devuelve un array de PROCESSOR_POWER_INFORMATION, uno por lógica de CPU.
-std::vector<double> get_core_frequencies_mhz() {
-    std::vector<double> freqs;
+        DWORD w = 0;
+        WriteFile(out_handle_, s.data(), static_cast<DWORD>(s.size()), &w, nullptr);
+#else
+        const char *p = s.data();
+        size_t left = s.size();
+        while (left > 0) {
+            ssize_t w = ::write(STDOUT_FILENO, p, left);
+            if (w < 0) { if (errno == EINTR) continue; return; }
+            p += w;
+            left -= static_cast<size_t>(w);
+        }
+#endif
+    }
+
+    std::string cur_, prev_, out_;
+    std::vector<size_t> cur_lines_, prev_lines_;
+    size_t shown_ = 0;   // líneas visibles del frame anterior
+    int rows_ = -1;
+    bool full_ = true;
+    bool emit_;
+#ifdef _WIN32
+    HANDLE out_handle_;
+#endif
+};
 
-    SYSTEM_INFO si;
-    GetSystemInfo(&si);
-    ULONG nproc = si.dwNumberOfProcessors;
-    if (nproc == 0) return freqs;
+// Qué mostrar y en qué forma (agrupación por topología, grupos desplegados).
+struct View {
+    int interval_ms = 1000;
+    int group = kLevelCpu;            // TopoLevel o kLevelCpu (sin agrupar)
+    std::vector<int> expand;          // ids de grupo con detalle por CPU
+    const CpuTopology *topo = nullptr;
+    const char *source = "";          // de dónde sale la frecuencia
+    TopoAggregator agg;
+    std::vector<GroupStat> stats;
+    FreqStats freq;                   // p50/p99 de la primera ventana por CPU
+    SelfCost self;                    // pie: coste del monitor (cpu_pct -1 = sin pie)
+    double budget_pct = 0;            // --budget: pie en rojo si se supera; 0 = sin límite
+};
 
-    const ULONG bufSize = nproc * sizeof(PROCESSOR_POWER_INFORMATION);
-    std::vector<BYTE> buffer(bufSize);
+static void render_cpu_line(Renderer& screen, const Sample& s, const FreqStats& fs, size_t i, int clr,
+                            const char *indent) {
+    if (s.mhz[i] > 0) {
+        screen.add("\x1b[%dm%s[CPU %zu]: %s", clr, indent, i, human_mhz(s.mhz[i]).c_str());
+    } else {
+        screen.add("\x1b[%dm%s[CPU %zu]: N/D", clr, indent, i);
+    }
+    if (i < fs.ncpu() && fs.windows() && fs.count(0, i)) {
+        screen.add("  p50 %s  p99 %s (%s)", human_mhz(fs.quantile(0, i, 0.5)).c_str(),
+                   human_mhz(fs.quantile(0, i, 0.99)).c_str(), fs.window_label(0));
+    }
+    if (i < s.util.size() && s.util[i].busy >= 0) {
+        screen.add("  uso %.1f%%  io %.1f%%  irq %.1f%%  steal %.1f%%",
+                   s.util[i].busy, s.util[i].iowait, s.util[i].irq, s.util[i].steal);
+    }
+    if (i < s.hw.size() && s.hw[i].ipc >= 0) {
+        screen.add("  IPC %.2f", s.hw[i].ipc);
+        if (s.hw[i].stall >= 0) screen.add("  stall %.1f%%", s.hw[i].stall * 100.0f);
+        if (s.hw[i].mpki >= 0) screen.add("  LLC %.2f/ki", s.hw[i].mpki);
+    }
+    if (i < s.thermal.size()) {
+        const CoreThermal& t = s.thermal[i];
+        if (t.temp_c >= 0) screen.add("  %.0f°C", t.temp_c);
+        if (t.throttle) {
+            screen.add("  \x1b[1mTHROTTLING %s\x1b[22m",
+                       t.throttle == (kThrottleCore | kThrottlePkg) ? "núcleo+paquete"
+                                                                    : t.throttle == kThrottleCore ? "núcleo" : "paquete");
+        }
+    }
+    if (i < s.trans.size()) {
+        const CoreTransitions& t = s.trans[i];
+        screen.add("  cambios %u  idle %u", t.changes, t.idle);
+        if (t.last_ns) screen.add(" (último hace %.2f s)", (s.t_ns - t.last_ns) / 1e9);
+    }
+    screen.add("\x1b[0m\n");
+}
+
+// Pie con el coste del propio monitor; en rojo por encima de --budget.
+static void render_self_footer(Renderer& screen, const View& view) {
+    if (view.self.cpu_pct < 0) return;
+    const bool over = view.budget_pct > 0 && view.self.cpu_pct > view.budget_pct;
+    screen.add("\x1b[%dm--- inexcpu: CPU %.2f%% (%.1f s)  RSS %s  syscalls E/S %.0f/s%s ---\x1b[0m\n",
+               over ? 31 : 0, view.self.cpu_pct, view.self.cpu_s, human_kb(view.self.rss_kb).c_str(),
+               view.self.syscalls_s, over ? "  SOBRE PRESUPUESTO" : "");
+}
 
-    NTSTATUS st = CallNtPowerInformation(ProcessorInformation, nullptr, 0,
-                                         buffer.data(), bufSize);
-    if (st != 0) {
-        // Fallback: Win32_Processor->CurrentClockSpeed no es por núcleo; omitimos.
-        return freqs;
+// Pinta una muestra: top de procesos y frecuencia/uso por núcleo o grupo.
+static void render_sample(Renderer& screen, const Sample& s, const int *changeClr, size_t nclr,
+                          View& view) {
+    screen.begin();
+    screen.add("=== Procesos en ejecución (PID, CPU%%, RSS, Nombre) ===\n");
+    for (const ProcSample& p : s.top) {
+        screen.add("%7lld  %5.1f%%  %9s  %s\n", p.pid, p.cpu_pct, human_kb(p.rss_kb).c_str(), p.name);
+    }
+    // --tasks: cada hilo caliente junto a la CPU donde corrió y su frecuencia
+    long long task = -1;
+    for (const ThreadSample& t : s.threads) {
+        if (t.pid != task) {
+            task = t.pid;
+            screen.add("=== Hilos de %lld (TID, CPU%%, CPU actual y MHz, cambios de contexto vol/invol por s) ===\n", task);
+        }
+        screen.add("%9lld  %5.1f%%", t.tid, t.cpu_pct);
+        if (t.cpu < 0) screen.add("  CPU   -          ");
+        else if (static_cast<size_t>(t.cpu) < s.mhz.size() && s.mhz[t.cpu] > 0)
+            screen.add("  CPU %3d %-10s", t.cpu, human_mhz(s.mhz[t.cpu]).c_str());
+        else screen.add("  CPU %3d N/D       ", t.cpu);
+        if (t.vcsw_s >= 0) screen.add("  %7.0f/%-7.0f", t.vcsw_s, t.ivcsw_s);
+        else screen.add("  %15s", "-");
+        screen.add("  %s\n", t.name);
+    }
+    screen.add("=== Frecuencia actual por núcleo (%s, t=%.3f s, cada %u ms%s) ===\n",
+               view.source, s.t_ns / 1e9, s.period_ms ? s.period_ms : static_cast<unsigned>(view.interval_ms),
+               s.burst ? ", ráfaga" : "");
+    // una línea por paquete con su temperatura y potencia
+    for (size_t i = 0; i < s.thermal.size(); ++i) {
+        const CoreThermal& t = s.thermal[i];
+        if (t.pkg < 0 || (t.pkg_temp_c < 0 && t.pkg_watts < 0)) continue;
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; ++j) seen = s.thermal[j].pkg == t.pkg;
+        if (seen) continue;
+        screen.add("[Paquete %d]:", t.pkg);
+        if (t.pkg_temp_c >= 0) screen.add(" %.0f°C", t.pkg_temp_c);
+        if (t.pkg_watts >= 0) screen.add(" %.1f W", t.pkg_watts);
+        screen.add("\n");
     }
 
-    auto *ppi = reinterpret_cast<PROCESSOR_POWER_INFORMATION*>(buffer.data());
-    freqs.resize(nproc);
-    for (ULONG i = 0; i < nproc; ++i) {
-        freqs[i] = static_cast<double>(ppi[i].CurrentMhz); // MHz actuales por CPU lógica
+    if (s.mhz.empty()) {
+        screen.add("No se pudo leer la frecuencia por núcleo en este sistema.\n");
+    } else if (view.group == kLevelCpu || !view.topo) {
+        for (size_t i = 0; i < s.mhz.size(); ++i) render_cpu_line(screen, s, view.freq, i, changeClr[i % nclr], "");
+    } else {
+        view.agg.run(*view.topo, view.group, s, view.stats);
+        const CpuTopology::Groups& g = view.topo->groups[view.group];
+        for (size_t k = 0; k < view.stats.size(); ++k) {
+            const GroupStat& st = view.stats[k];
+            screen.add("[%s %d] %u cpus  MHz min %.0f avg %.0f max %.0f", kLevelTags[view.group], st.id,
+                       st.ncpu, st.fmin, st.favg, st.fmax);
+            if (st.uavg >= 0) screen.add("  uso min %.1f%% avg %.1f%% max %.1f%%", st.umin, st.uavg, st.umax);
+            screen.add("\n");
+            if (std::find(view.expand.begin(), view.expand.end(), st.id) == view.expand.end()) continue;
+            for (uint32_t j = g.start[k]; j < g.start[k + 1]; ++j) {
+                const uint32_t c = g.cpus[j];
+                if (c < s.mhz.size()) render_cpu_line(screen, s, view.freq, c, changeClr[c % nclr], "    ");
+            }
+        }
+    }
+    if (!s.cgroups.empty()) {
+        screen.add("=== Cgroups (CPU%%, estrangulado, estrangulamientos/s) ===\n");
+        for (const CgroupSample& g : s.cgroups)
+            screen.add("%7.1f%%  %5.1f%%  %7.1f  %s\n", g.usage_pct, g.throttled_pct, g.throttles_s, g.path);
     }
-    return freqs;
+    render_self_footer(screen, view);
+    screen.present();
 }
+
+// --interactive: teclado en modo crudo (sin eco ni línea) mientras dura la
+// vista. read_key() espera como mucho timeout_ms, así que una tecla se
+// atiende en el mismo frame. Las secuencias de escape que llegan juntas se
+// guardan para las siguientes llamadas.
+enum : int { kKeyNone = -1, kKeyUp = 256, kKeyDown, kKeyPgUp, kKeyPgDn, kKeyHome, kKeyEnd };
+
+class RawTerminal {
+public:
+    RawTerminal() {
+#ifdef _WIN32
+        in_ = GetStdHandle(STD_INPUT_HANDLE);
+        if (GetConsoleMode(in_, &saved_)) {
+            active_ = SetConsoleMode(in_, saved_ & ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT)) != 0;
+        }
 #else
-// Linux: intentar sysfs cpufreq; si no está, usar /proc/cpuinfo (cpu MHz)
-std::vector<double> get_core_frequencies_mhz() {
-    std::vector<double> freqs;
+        // en segundo plano tcsetattr pararía el proceso (SIGTTOU): sin teclado
+        if (isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp() && tcgetattr(STDIN_FILENO, &saved_) == 0) {
+            termios raw = saved_;
+            raw.c_lflag &= ~(ICANON | ECHO);   // ISIG se queda: Ctrl-C sigue funcionando
+            raw.c_cc[VMIN] = 0;
+            raw.c_cc[VTIME] = 0;
+            active_ = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+        }
+#endif
+    }
+    ~RawTerminal() {
+#ifdef _WIN32
+        if (active_) SetConsoleMode(in_, saved_);
+#else
+        if (active_) tcsetattr(STDIN_FILENO, TCSANOW, &saved_);
+#endif
+    }
+    RawTerminal(const RawTerminal&) = delete;
+    RawTerminal& operator=(const RawTerminal&) = delete;
 
-    // Intento 1: /sys/devices/system/cpu/cpu*/cpufreq/scaling_cur_freq (kHz)
-    {
-        // Contar CPUs lógicas por /sys/devices/system/cpu/cpu[0-9]+
-        std::vector<int> cpus;
-        DIR *d = opendir("/sys/devices/system/cpu");
-        if (d) {
-            std::regex re("^cpu([0-9]+)$");
-            if (struct dirent *de; true) {
-                while ((de = readdir(d)) != nullptr) {
-                    std::cmatch m;
-                    if (std::regex_match(de->d_name, m, re)) {
-                        int id = std::stoi(m[1]);
-                        cpus.push_back(id);
+    bool active() const { return active_; }
+
+    // Una tecla (carácter o kKey*), o kKeyNone si no llegó ninguna.
+    int read_key(int timeout_ms) {
+#ifdef _WIN32
+        if (!active_ || WaitForSingleObject(in_, static_cast<DWORD>(timeout_ms)) != WAIT_OBJECT_0) return kKeyNone;
+        INPUT_RECORD rec;
+        DWORD n = 0;
+        if (!ReadConsoleInputW(in_, &rec, 1, &n) || n == 0) return kKeyNone;
+        if (rec.EventType != KEY_EVENT || !rec.Event.KeyEvent.bKeyDown) return kKeyNone;
+        switch (rec.Event.KeyEvent.wVirtualKeyCode) {
+        case VK_UP: return kKeyUp;
+        case VK_DOWN: return kKeyDown;
+        case VK_PRIOR: return kKeyPgUp;
+        case VK_NEXT: return kKeyPgDn;
+        case VK_HOME: return kKeyHome;
+        case VK_END: return kKeyEnd;
+        default: break;
+        }
+        const WCHAR c = rec.Event.KeyEvent.uChar.UnicodeChar;
+        return c > 0 && c < 128 ? static_cast<int>(c) : kKeyNone;
+#else
+        if (!active_) {
+            if (timeout_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return kKeyNone;
+        }
+        if (len_ == 0) {
+            pollfd p{ STDIN_FILENO, POLLIN, 0 };
+            if (::poll(&p, 1, timeout_ms) <= 0) return kKeyNone;
+            const ssize_t n = ::read(STDIN_FILENO, buf_, sizeof(buf_));
+            if (n <= 0) return kKeyNone;
+            len_ = static_cast<size_t>(n);
+        }
+        return parse_key();
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE in_ = nullptr;
+    DWORD saved_ = 0;
+#else
+    // ESC [ A/B/H/F, ESC [ 1~/4~/5~/6~ y ESC O H/F; un ESC suelto se descarta.
+    int parse_key() {
+        size_t used = 1;
+        int key = static_cast<unsigned char>(buf_[0]);
+        if (key == 0x1b) {
+            key = kKeyNone;
+            if (len_ >= 3 && (buf_[1] == '[' || buf_[1] == 'O')) {
+                used = 3;
+                switch (buf_[2]) {
+                case 'A': key = kKeyUp; break;
+                case 'B': key = kKeyDown; break;
+                case 'H': key = kKeyHome; break;
+                case 'F': key = kKeyEnd; break;
+                default:
+                    if (len_ >= 4 && buf_[3] == '~') {
+                        used = 4;
+                        switch (buf_[2]) {
+                        case '1': key = kKeyHome; break;
+                        case '4': key = kKeyEnd; break;
+                        case '5': key = kKeyPgUp; break;
+                        case '6': key = kKeyPgDn; break;
+                        default: break;
+                        }
                     }
+                    break;
                 }
+            } else {
+                used = len_;   // secuencia que no se reconoce: fuera entera
             }
-            closedir(d);
         }
+        std::memmove(buf_, buf_ + used, len_ - used);
+        len_ -= used;
+        return key;
+    }
+
+    termios saved_{};
+    char buf_[32];
+    size_t len_ = 0;
+#endif
+    bool active_ = false;
+};
 
-        if (!cpus.empty()) {
-            std::sort(cpus.begin(), cpus.end());
-            freqs.resize(cpus.back() + 1, -1.0);
+// Estado de la vista interactiva: dos paneles desplazables (procesos y
+// núcleos) con su primera fila visible. procs es la última tabla completa
+// del muestreador (ProcSnapshot), ordenada aquí al llegar o al cambiar la
+// clave; los recorridos y el formato son solo de las filas en pantalla.
+struct Viewport {
+    enum { kProcs, kCores };
+    int pane = kProcs;
+    size_t off[2] = { 0, 0 };
+    size_t page[2] = { 1, 1 };         // filas visibles por panel en el último frame
+    size_t total[2] = { 0, 0 };
+    int sort = kSortCpu;
+    bool reverse = false;
+    bool dirty = true;                 // reordenar antes de pintar
+    std::vector<ProcSample> procs;
 
-            for (int id : cpus) {
-                std::ostringstream p;
-                p << "/sys/devices/system/cpu/cpu" << id << "/cpufreq/scaling_cur_freq";
-                std::ifstream f(p.str());
-                if (f) {
-                    long khz = 0;
-                    f >> khz;
-                    if (khz > 0) freqs[id] = khz / 1000.0; // a MHz
-                }
+    // El orden de ProcQuery::before, sobre ProcSample.
+    void sort_rows() {
+        dirty = false;
+        auto before = [&](const ProcSample& a, const ProcSample& b) {
+            switch (sort) {
+            case kSortCpu: if (a.cpu_pct != b.cpu_pct) return a.cpu_pct > b.cpu_pct; break;
+            case kSortRss: if (a.rss_kb != b.rss_kb) return a.rss_kb > b.rss_kb; break;
+            case kSortName: if (int c = std::strcmp(a.name, b.name)) return c < 0; break;
+            default: break;
             }
+            return a.pid < b.pid;
+        };
+        std::sort(procs.begin(), procs.end(),
+                  [&](const ProcSample& a, const ProcSample& b) { return reverse ? before(b, a) : before(a, b); });
+    }
 
-            // Si al menos una se leyó, devolver (aunque haya -1 en algunas)
-            bool any = false;
-            for (double x : freqs) if (x > 0) { any = true; break; }
-            if (any) return freqs;
-            freqs.clear(); // caer al fallback
+    // Aplica una tecla; false si no cambia nada.
+    bool key(int k) {
+        size_t& o = off[pane];
+        const size_t pg = std::max<size_t>(page[pane], 1);
+        const size_t last = total[pane] > pg ? total[pane] - pg : 0;
+        switch (k) {
+        case kKeyUp: case 'k': if (o == 0) return false; --o; return true;
+        case kKeyDown: case 'j': if (o >= last) return false; ++o; return true;
+        case kKeyPgUp: o = o > pg ? o - pg : 0; return true;
+        case kKeyPgDn: case ' ': o = std::min(o + pg, last); return true;
+        case kKeyHome: case 'g': o = 0; return true;
+        case kKeyEnd: case 'G': o = last; return true;
+        case '\t': pane = pane == kProcs ? kCores : kProcs; return true;
+        case 'c': return set_sort(kSortCpu);
+        case 'm': return set_sort(kSortRss);
+        case 'p': return set_sort(kSortPid);
+        case 'n': return set_sort(kSortName);
+        case 'r': reverse = !reverse; dirty = true; return true;
+        default: return false;
         }
     }
 
-    // Fallback: /proc/cpuinfo -> "processor" y "cpu MHz"
-    {
-        std::ifstream f("/proc/cpuinfo");
-        if (!f) return freqs;
-
-        std::string line;
-        int currentCPU = -1;
-        std::map<int, double> mhz;
-        while (std::getline(f, line)) {
-            if (line.rfind("processor", 0) == 0) {
-                size_t pos = line.find(':');
-                if (pos != std::string::npos) {
-                    currentCPU = std::stoi(line.substr(pos + 1));
-                }
-            } else if (line.rfind("cpu MHz", 0) == 0 && currentCPU >= 0) {
-                size_t pos = line.find(':');
-                if (pos != std::string::npos) {
-                    double v = std::stod(line.substr(pos + 1));
-                    mhz[currentCPU] = v;
+private:
+    bool set_sort(int k) {
+        if (sort == k) return false;
+        sort = k;
+        dirty = true;
+        off[kProcs] = 0;
+        return true;
+    }
+};
+
+// Un frame de --interactive: cabecera con las teclas, la ventana de
+// procesos y la de núcleos repartiéndose la altura del terminal, y el pie
+// de coste propio. Lo que no cabe ni se formatea.
+static void render_interactive(Renderer& screen, const Sample& s, const int *changeClr, size_t nclr,
+                               View& view, Viewport& vp) {
+    if (vp.dirty) vp.sort_rows();
+    const size_t height = static_cast<size_t>(std::max(screen.height(), 8));
+    const size_t fixed = 4 + (view.self.cpu_pct >= 0 ? 1 : 0);   // cabeceras, pie y la fila libre del cursor
+    const size_t body = height > fixed + 2 ? height - fixed : 2;
+    vp.total[Viewport::kProcs] = vp.procs.size();
+    vp.total[Viewport::kCores] = s.mhz.size();
+    const size_t ncores = std::min(vp.total[Viewport::kCores], std::max<size_t>(body / 2, 1));
+    vp.page[Viewport::kCores] = ncores;
+    vp.page[Viewport::kProcs] = body - ncores;
+    for (int p = 0; p < 2; ++p) {
+        const size_t last = vp.total[p] > vp.page[p] ? vp.total[p] - vp.page[p] : 0;
+        vp.off[p] = std::min(vp.off[p], last);
+    }
+
+    screen.begin();
+    screen.add("inexcpu  ↑↓ PgUp/PgDn Inicio/Fin: mover  Tab: panel  c/m/p/n: orden  r: invertir  q: salir\n");
+    const size_t po = vp.off[Viewport::kProcs];
+    const size_t pe = std::min(po + vp.page[Viewport::kProcs], vp.procs.size());
+    screen.add("%s=== Procesos %zu-%zu de %zu (PID, CPU%%, RSS, Nombre; orden %s%s) ===\x1b[0m\n",
+               vp.pane == Viewport::kProcs ? "\x1b[7m" : "", pe ? po + 1 : 0, pe, vp.procs.size(),
+               kSortNames[vp.sort], vp.reverse ? ", invertido" : "");
+    for (size_t i = po; i < pe; ++i) {
+        const ProcSample& p = vp.procs[i];
+        screen.add("%7lld  %5.1f%%  %9s  %s\n", p.pid, p.cpu_pct, human_kb(p.rss_kb).c_str(), p.name);
+    }
+    for (size_t i = pe - po; i < vp.page[Viewport::kProcs]; ++i) screen.add("\n");
+
+    const size_t co = vp.off[Viewport::kCores];
+    const size_t ce = std::min(co + ncores, s.mhz.size());
+    screen.add("%s=== Núcleos %zu-%zu de %zu (%s, cada %u ms%s) ===\x1b[0m\n",
+               vp.pane == Viewport::kCores ? "\x1b[7m" : "", ce ? co + 1 : 0, ce, s.mhz.size(), view.source,
+               s.period_ms ? s.period_ms : static_cast<unsigned>(view.interval_ms), s.burst ? ", ráfaga" : "");
+    for (size_t c = co; c < ce; ++c) render_cpu_line(screen, s, view.freq, c, changeClr[c % nclr], "");
+    render_self_footer(screen, view);
+    screen.present();
+}
+
+static void usage_text(const char *argv0) {
+    std::printf("Uso: %s [opciones]\n"
+                "  --daemon          sin TUI: solo el hilo muestreador (para exportadores)\n"
+                "  -i, --interactive vista desplazable de todos los procesos y núcleos con\n"
+                "                    teclado (flechas, PgUp/PgDn, Tab, c/m/p/n para ordenar)\n"
+                "  --format F        muestras a stdout en lugar de la TUI: json (una línea\n"
+                "                    por muestra), csv (una fila por CPU) o text (clave=valor)\n"
+                "  --count N         escribe N muestras y sale (por defecto --format text)\n"
+                "  --once            lo mismo que --count 1\n"
+                "  --interval MS     periodo de muestreo en ms (10..60000, por defecto 1000)\n"
+                "  --adaptive        relee menos los núcleos y procesos estables; ráfaga a\n"
+                "                    100 Hz durante 10 s ante caídas de frecuencia o picos\n"
+                "  --record FICHERO  añade las muestras a una grabación binaria\n"
+                "  --replay FICHERO  reproduce una grabación en lugar de muestrear\n"
+                "  --listen [H]:P    sirve /metrics (OpenMetrics) en host:puerto, p. ej. :9105\n"
+                "  --agent H:P       envía las muestras a un agregador (--aggregate)\n"
+                "  --aggregate [H]:P recibe de los agentes y muestra la vista de flota\n"
+                "  --perf            frecuencia efectiva, IPC y stalls con perf_event_open\n"
+                "                    (lo mismo que --freq-source perf)\n"
+                "  --freq-source F   fuente de frecuencia: %s\n"
+                "                    (por defecto la primera que funcione)\n"
+                "  --proc-source F   fuente de procesos: %s\n"
+                "  --threads N       hilos para recorrer /proc (1..64, por defecto 1)\n"
+                "  --pin-cpu N       fija todo el monitor en la CPU N (CPU de servicio)\n"
+                "  --rt              hilo muestreador en SCHED_FIFO / prioridad crítica\n"
+                "  --budget PCT      pie de coste propio en rojo si pasa de PCT %% de una CPU\n"
+                "  --no-uring        lecturas de /proc síncronas aunque haya io_uring\n"
+                "  --top N           procesos mostrados (0..1000, por defecto 25)\n"
+                "  --sort K          orden: cpu, rss, pid o name (por defecto cpu)\n"
+                "  --filter name=~RE solo procesos cuyo nombre casa con RE (o name=EXACTO)\n"
+                "  --cgroup PREFIJO  solo procesos bajo ese cgroup, p. ej. /system.slice\n"
+                "  --tasks L         hilos más activos de esos PIDs (hasta 8), p. ej. 1234,5678\n"
+                "  --thermal         temperaturas, potencia RAPL y throttling térmico por CPU\n"
+                "  --cgroups         uso de CPU y estrangulamiento por cgroup v2 (cpu.stat)\n"
+                "  --windows L       ventanas de p50/p99 e histogramas, p. ej. 10s,1m,5m (por defecto)\n"
+                "  --group NIVEL     agrupa núcleos: cpu, package, node, l3, smt (por defecto cpu)\n"
+                "  --expand L        ids de grupo con detalle por CPU, p. ej. 0,2\n"
+                "  --bench           mide el coste de los caminos de muestreo y sale\n"
+                "  --bench-pids L    tamaños de /proc sintético, p. ej. 1000,10000,100000\n"
+                "  --bench-iters N   iteraciones máximas por benchmark (por defecto 5000)\n"
+                "  -h, --help        esta ayuda\n",
+                argv0, FrequencyBackends::names().c_str(), ProcessBackends::names().c_str());
+}
+
+// ------------------------------ Flota -----------------------------
+// --agent host:puerto envía las muestras a un agregador por una conexión
+// TCP persistente con el mismo formato que --record: la cabecera INXREC1,
+// un frame 'H' con el nombre del host y luego frames 'K'/'D'. Si la
+// conexión cae se reintenta con espera creciente (1..30 s) y el flujo
+// vuelve a empezar con cabecera y un 'K'.
+// --aggregate [host]:puerto recibe de N agentes con un bucle epoll (WSAPoll
+// en Windows), decodifica cada flujo con su propio RecordDecoder y pinta
+// la vista de flota: hosts más estrangulados y núcleos más calientes.
+static std::string host_name() {
+    char buf[256] = {};
+    if (gethostname(buf, sizeof(buf) - 1) != 0 || !buf[0]) return "?";
+    return buf;
+}
+
+class AgentSender {
+public:
+    static const int64_t kStallNs = 5000000000LL;   // aggregator que no lee: reconectar
+
+    ~AgentSender() { if (fd_ != kBadSocket) close_socket(fd_); }
+
+    bool open(const char *spec) {
+        if (!split_host_port(spec, host_, port_) || host_.empty()) {
+            std::fprintf(stderr, "--agent espera host:puerto\n");
+            return false;
+        }
+        name_ = host_name();
+        return true;
+    }
+
+    void run(const SampleRing& ring) {
+        Sample s;
+        uint64_t next = ring.head() + 1;
+        int64_t retry_at = 0;
+        int backoff_s = 1;
+        while (!g_stop) {
+            ring.wait(next - 1, std::chrono::milliseconds(1000));
+            if (fd_ == kBadSocket) {
+                next = ring.head() + 1;     // lo que pasó desconectado se pierde
+                if (monotonic_ns() < retry_at) continue;
+                fd_ = connect_tcp(host_, port_, 2000);
+                if (fd_ == kBadSocket) {
+                    retry_at = monotonic_ns() + backoff_s * 1000000000LL;
+                    backoff_s = std::min(backoff_s * 2, 30);
+                    continue;
                 }
+                backoff_s = 1;
+                start_stream();
+            }
+            while (next <= ring.head()) {
+                if (!ring.read(next, s)) { next = ring.head(); continue; }  // nos adelantaron
+                enc_.encode(s, out_);
+                ++next;
+            }
+            if (!flush()) {
+                close_socket(fd_);
+                fd_ = kBadSocket;
             }
         }
-        if (!mhz.empty()) {
-            int maxId = mhz.rbegin()->first;
-            freqs.assign(maxId + 1, -1.0);
-            for (auto &kv : mhz) freqs[kv.first] = kv.second;
+    }
+
+private:
+    void start_stream() {
+        enc_ = RecordEncoder{};
+        out_.assign(kRecMagic, sizeof(kRecMagic));
+        put_u16(out_, kRecVersion);
+        put_u16(out_, 0);
+        put_u32(out_, 0);
+        put_u8(out_, 'H');
+        put_varint(out_, name_.size());
+        out_ += name_;
+    }
+
+    // Envía out_ entero; false si la conexión se perdió o no avanza.
+    bool flush() {
+        size_t off = 0;
+        const int64_t t0 = monotonic_ns();
+        while (off < out_.size()) {
+            const int n = static_cast<int>(::send(fd_, out_.data() + off, static_cast<int>(out_.size() - off), kSendFlags));
+            if (n > 0) { off += n; continue; }
+            if (n < 0 && !would_block()) return false;
+            if (monotonic_ns() - t0 > kStallNs || g_stop) return false;
+            pollfd p{ fd_, POLLOUT, 0 };
+            poll_sockets(&p, 1, 200);
         }
-        return freqs;
+        out_.clear();
+        return true;
     }
-}
-#endif
 
-// ----------------------- Lista de procesos ----------------------
-#ifdef _WIN32
-struct ProcInfo { DWORD pid; std::string name; };
+    std::string host_, port_, name_;
+    socket_t fd_ = kBadSocket;
+    RecordEncoder enc_;
+    std::string out_;
+};
 
-std::vector<ProcInfo> list_processes() {
-    std::vector<ProcInfo> out;
+class FleetAggregator {
+public:
+    static const size_t kMaxAgents = 4096;
+    static const size_t kShown = 10;
+    static const int64_t kStaleNs = 10000000000LL;  // sin frames: fuera de los rankings
 
-    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-    if (snap == INVALID_HANDLE_VALUE) return out;
+    ~FleetAggregator() {
+        for (auto& a : agents_) if (a->fd != kBadSocket) close_socket(a->fd);
+        if (listen_fd_ != kBadSocket) close_socket(listen_fd_);
+#ifndef _WIN32
+        if (ep_ >= 0) ::close(ep_);
+#endif
+    }
 
-    PROCESSENTRY32 pe;
-    pe.dwSize = sizeof(pe);
-    if (Process32First(snap, &pe)) {
-        do {
-            out.push_back(ProcInfo{ pe.th32ProcessID, pe.szExeFile });
-        } while (Process32Next(snap, &pe));
+    bool listen(const char *spec) {
+        spec_ = spec;
+        listen_fd_ = listen_tcp(spec, "--aggregate", 1024);
+        if (listen_fd_ == kBadSocket) return false;
+#ifndef _WIN32
+        ep_ = ::epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;   // nullptr = el socket de escucha
+        if (ep_ < 0 || ::epoll_ctl(ep_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0) { std::perror("epoll"); return false; }
+#endif
+        return true;
     }
-    CloseHandle(snap);
-    return out;
-}
+
+    // Bucle hasta g_stop; con draw, la vista de flota cada interval_ms.
+    void run(int interval_ms, bool draw) {
+        std::unique_ptr<Renderer> screen;
+        if (draw) screen.reset(new Renderer());
+        const int64_t period = static_cast<int64_t>(interval_ms) * 1000000LL;
+        int64_t next_draw = monotonic_ns() + period;
+#ifndef _WIN32
+        epoll_event evs[256];
+#else
+        std::vector<pollfd> pfds;
+#endif
+        while (!g_stop) {
+            const int wait_ms = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(200, (next_draw - monotonic_ns()) / 1000000)));
+#ifndef _WIN32
+            const int n = ::epoll_wait(ep_, evs, 256, wait_ms);
+            for (int i = 0; i < n; ++i) {
+                if (!evs[i].data.ptr) accept_agents();
+                else read_agent(*static_cast<Agent*>(evs[i].data.ptr));
+            }
 #else
-struct ProcInfo { pid_t pid; std::string name; };
+            pfds.clear();
+            pfds.push_back(pollfd{ listen_fd_, POLLIN, 0 });
+            for (auto& a : agents_) pfds.push_back(pollfd{ a->fd, POLLIN, 0 });
+            if (poll_sockets(pfds.data(), pfds.size(), wait_ms) > 0) {
+                const size_t na = agents_.size();    // accept_agents() añade al final
+                for (size_t i = 0; i < na; ++i)
+                    if (pfds[i + 1].revents) read_agent(*agents_[i]);
+                if (pfds[0].revents & POLLIN) accept_agents();
+            }
+#endif
+            sweep();
+            const int64_t now = monotonic_ns();
+            if (now >= next_draw) {
+                if (screen) render(*screen, now, double(now - next_draw + period) / 1e9);
+                frames_ = 0;
+                next_draw = now + period;
+            }
+        }
+    }
 
-std::vector<ProcInfo> list_processes() {
-    std::vector<ProcInfo> out;
-    DIR *d = opendir("/proc");
-    if (!d) return out;
+private:
+    struct Agent {
+        socket_t fd = kBadSocket;
+        std::string host;
+        std::string in;
+        size_t off = 0;
+        bool header = false;
+        RecordDecoder dec;
+        Sample last;
+        double peak_mhz = 0;          // la máxima vista en este host
+        int64_t last_ns = 0;          // monotonic del último frame (reloj del agregador)
+        bool dead = false;
+    };
 
-    struct dirent *de;
-    while ((de = readdir(d)) != nullptr) {
-        // directorios numéricos = PIDs
-        if (!std::all_of(de->d_name, de->d_name + std::strlen(de->d_name), ::isdigit))
-            continue;
-
-        pid_t pid = static_cast<pid_t>(std::stoi(de->d_name));
-        std::string commPath = std::string("/proc/") + de->d_name + "/comm";
-        std::ifstream f(commPath);
-        std::string name;
-        if (f && std::getline(f, name)) {
-            if (!name.empty() && name.back() == '\n') name.pop_back();
-        } else {
-            // fallback: /status Name:
-            std::ifstream s(std::string("/proc/") + de->d_name + "/status");
-            std::string line;
-            while (std::getline(s, line)) {
-                if (line.rfind("Name:", 0) == 0) {
-                    name = line.substr(5);
-                    // trim
-                    name.erase(0, name.find_first_not_of(" \t"));
-                    break;
+    void accept_agents() {
+        for (;;) {
+            sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+            socket_t fd = ::accept(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+            if (fd == kBadSocket) return;
+            if (agents_.size() >= kMaxAgents) { close_socket(fd); continue; }
+            set_nonblocking(fd);
+            std::unique_ptr<Agent> a(new Agent());
+            a->fd = fd;
+            char host[NI_MAXHOST] = "?";
+            getnameinfo(reinterpret_cast<sockaddr*>(&addr), len, host, sizeof(host), nullptr, 0, NI_NUMERICHOST);
+            a->host = host;     // hasta que llegue el 'H'
+#ifndef _WIN32
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = a.get();
+            if (::epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) < 0) { close_socket(fd); continue; }
+#endif
+            agents_.push_back(std::move(a));
+        }
+    }
+
+    void read_agent(Agent& a) {
+        if (a.dead) return;
+        char buf[64 * 1024];
+        for (int k = 0; k < 16; ++k) {      // no acaparar el bucle con un solo agente
+            const int n = static_cast<int>(::recv(a.fd, buf, sizeof(buf), 0));
+            if (n == 0 || (n < 0 && !would_block())) { a.dead = true; return; }
+            if (n < 0) break;
+            a.in.append(buf, n);
+            if (n < static_cast<int>(sizeof(buf))) break;
+        }
+        if (!consume(a)) a.dead = true;
+    }
+
+    // Procesa los frames completos de a.in; false si el flujo no es válido.
+    bool consume(Agent& a) {
+        const uint8_t *data = reinterpret_cast<const uint8_t*>(a.in.data());
+        const size_t size = a.in.size();
+        if (!a.header) {
+            if (size - a.off < kRecHeaderSize) return true;
+            if (std::memcmp(data + a.off, kRecMagic, sizeof(kRecMagic)) != 0) return false;
+            ByteReader r{ data + a.off + sizeof(kRecMagic), data + a.off + kRecHeaderSize };
+            a.dec.set_version(r.u16());
+            a.off += kRecHeaderSize;
+            a.header = true;
+        }
+        while (a.off < size) {
+            ByteReader r{ data + a.off, data + size };
+            const uint8_t kind = r.u8();
+            const uint64_t len = r.varint();
+            if (!r.ok) break;                                   // cabecera del frame incompleta
+            if (len > (1u << 22)) return false;
+            if (len > static_cast<uint64_t>(r.end - r.p)) break;  // cuerpo incompleto
+            if (kind == 'H') {
+                a.host.assign(reinterpret_cast<const char*>(r.p), std::min<size_t>(len, 64));
+            } else if (a.dec.decode(kind, r.p, r.p + len, a.last)) {
+                for (double m : a.last.mhz) a.peak_mhz = std::max(a.peak_mhz, m);
+                a.last_ns = monotonic_ns();
+                ++frames_;
+            }
+            a.off = static_cast<size_t>(r.p + len - data);
+        }
+        if (a.off == a.in.size()) { a.in.clear(); a.off = 0; }
+        else if (a.off > 64 * 1024) { a.in.erase(0, a.off); a.off = 0; }
+        return true;
+    }
+
+    // Cierra los agentes caídos (fuera del bucle de eventos: un lote de
+    // epoll puede traer varios eventos del mismo agente).
+    void sweep() {
+        for (size_t i = 0; i < agents_.size();) {
+            if (!agents_[i]->dead) { ++i; continue; }
+            close_socket(agents_[i]->fd);   // también lo quita del epoll
+            agents_[i] = std::move(agents_.back());
+            agents_.pop_back();
+        }
+    }
+
+    struct HostRank { const Agent *a; uint32_t throttled, ncpu; double avg, ratio; };
+    struct CoreRank { const Agent *a; uint32_t cpu; float temp; double mhz; };
+
+    void render(Renderer& screen, int64_t now, double dt_s) {
+        hosts_.clear();
+        cores_.clear();
+        size_t stale = 0;
+        for (const auto& p : agents_) {
+            const Agent& a = *p;
+            if (!a.last_ns || now - a.last_ns > kStaleNs) { ++stale; continue; }
+            HostRank h{ &a, 0, 0, 0, 1 };
+            double sum = 0;
+            for (size_t i = 0; i < a.last.mhz.size(); ++i) {
+                if (a.last.mhz[i] > 0) { sum += a.last.mhz[i]; ++h.ncpu; }
+                if (i < a.last.thermal.size()) {
+                    const CoreThermal& t = a.last.thermal[i];
+                    if (t.throttle) ++h.throttled;
+                    if (t.temp_c >= 0) cores_.push_back(CoreRank{ &a, static_cast<uint32_t>(i), t.temp_c, a.last.mhz[i] });
                 }
             }
+            if (h.ncpu) {
+                h.avg = sum / h.ncpu;
+                if (a.peak_mhz > 0) h.ratio = h.avg / a.peak_mhz;
+            }
+            hosts_.push_back(h);
         }
-        if (!name.empty()) {
-            out.push_back(ProcInfo{ pid, name });
+        // más estrangulado: más núcleos con throttling y, a igualdad, más
+        // lejos de la máxima frecuencia que ha dado ese host
+        const size_t nh = std::min(kShown, hosts_.size());
+        std::partial_sort(hosts_.begin(), hosts_.begin() + nh, hosts_.end(), [](const HostRank& x, const HostRank& y) {
+            if (x.throttled != y.throttled) return x.throttled > y.throttled;
+            return x.ratio < y.ratio;
+        });
+        const size_t nc = std::min(kShown, cores_.size());
+        std::partial_sort(cores_.begin(), cores_.begin() + nc, cores_.end(),
+                          [](const CoreRank& x, const CoreRank& y) { return x.temp > y.temp; });
+
+        screen.begin();
+        screen.add("=== Flota en %s: %zu agentes (%zu sin datos), %.0f frames/s ===\n", spec_.c_str(),
+                   agents_.size(), stale, dt_s > 0 ? frames_ / dt_s : 0.0);
+        screen.add("=== Hosts más estrangulados (throttling, MHz medio, %% de su máximo) ===\n");
+        for (size_t k = 0; k < nh; ++k) {
+            const HostRank& h = hosts_[k];
+            screen.add("%-32.32s  %4u/%-4u  %9s  %5.1f%%\n", h.a->host.c_str(), h.throttled, h.ncpu,
+                       human_mhz(h.avg).c_str(), h.ratio * 100.0);
+        }
+        screen.add("=== Núcleos más calientes ===\n");
+        if (cores_.empty()) screen.add("Ningún agente envía temperaturas (--thermal).\n");
+        for (size_t k = 0; k < nc; ++k) {
+            const CoreRank& c = cores_[k];
+            screen.add("%-32.32s  [CPU %u]  %5.1f°C  %s\n", c.a->host.c_str(), c.cpu, c.temp,
+                       c.mhz > 0 ? human_mhz(c.mhz).c_str() : "N/D");
         }
+        screen.present();
     }
-    closedir(d);
-    std::sort(out.begin(), out.end(), [](const ProcInfo& a, const ProcInfo& b){
-        return a.pid < b.pid;
-    });
-    return out;
-}
+
+    std::string spec_;
+    socket_t listen_fd_ = kBadSocket;
+#ifndef _WIN32
+    int ep_ = -1;
 #endif
+    std::vector<std::unique_ptr<Agent>> agents_;   // punteros estables para epoll
+    std::vector<HostRank> hosts_;
+    std::vector<CoreRank> cores_;
+    uint64_t frames_ = 0;
+};
 
-// ----------------------------- Main -----------------------------
-int main() {
-    
-    srand(time(NULL));  
-    auto fc = get_core_frequencies_mhz();
-    int changeClr[fc.size()];
-    for (int i = 0; i < fc.size(); i++) {
-        changeClr[i] = (rand() % 14) + 31;
+// ------------------------------ Bench -----------------------------
+// --bench mide el propio coste del monitor en los caminos calientes:
+// ns/op, syscalls/op y reservas de memoria/op. En Linux las llamadas al
+// sistema se cuentan con el tracepoint raw_syscalls:sys_enter (perf) y, si
+// no está permitido, con syscr+syscw de /proc/self/io (solo lecturas y
+// escrituras). La tabla de procesos se mide también sobre árboles /proc
+// sintéticos de tamaño configurable.
+class SyscallCounter {
+public:
+    SyscallCounter() {
+#ifndef _WIN32
+        static const char *ids[] = { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                                     "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" };
+        for (const char *p : ids) {
+            char buf[32];
+            ssize_t n = read_small_file(p, buf, sizeof(buf));
+            if (n <= 0) continue;
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_TRACEPOINT;
+            attr.size = sizeof(attr);
+            attr.config = static_cast<uint64_t>(parse_long(buf, buf + n));
+            fd_ = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd_ >= 0) { method_ = "perf"; return; }
+        }
+        io_fd_ = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+        if (io_fd_ >= 0) method_ = "/proc/self/io";
+#endif
     }
+    ~SyscallCounter() {
+#ifndef _WIN32
+        if (fd_ >= 0) ::close(fd_);
+        if (io_fd_ >= 0) ::close(io_fd_);
+#endif
+    }
+    SyscallCounter(const SyscallCounter&) = delete;
+    SyscallCounter& operator=(const SyscallCounter&) = delete;
+
+    const char *method() const { return method_; }
+    bool available() const { return method_[0] != '\0'; }
+
+    // Total acumulado (la propia lectura cuenta como una llamada).
+    uint64_t read() {
+#ifndef _WIN32
+        if (fd_ >= 0) {
+            uint64_t v = 0;
+            return ::read(fd_, &v, sizeof(v)) == sizeof(v) ? v : 0;
+        }
+        if (io_fd_ >= 0) {
+            char buf[512];
+            ssize_t n = ::pread(io_fd_, buf, sizeof(buf), 0);
+            if (n <= 0) return 0;
+            uint64_t total = 0;
+            for (const char *key : { "syscr: ", "syscw: " }) {
+                const char *p = static_cast<const char*>(memmem(buf, n, key, std::strlen(key)));
+                if (p) total += parse_ull(p + std::strlen(key), buf + n);
+            }
+            return total;
+        }
+#endif
+        return 0;
+    }
+
+private:
+    int fd_ = -1, io_fd_ = -1;
+    const char *method_ = "";
+};
 
-    do {
-        size_t cont=0;
-        // datos de la cpu
-        auto freqs = get_core_frequencies_mhz(); 
-        // Frecuencia por núcleo
-         // Procesos
-        std::cout << "=== Procesos en ejecución (PID, Nombre) ===\n";
+struct BenchResult { uint64_t iters; double ns, syscalls, allocs; };
+
+// Ejecuta fn hasta max_iters veces o hasta agotar budget_ns (mínimo 3).
+template <class F>
+static BenchResult run_bench(SyscallCounter& sc, F&& fn, uint64_t max_iters, int64_t budget_ns) {
+    fn();  // calentamiento: primeras reservas, apertura de fds...
+    const uint64_t a0 = g_allocs.load(std::memory_order_relaxed);
+    const uint64_t s0 = sc.read();
+    const int64_t t0 = monotonic_ns();
+    uint64_t n = 0;
+    int64_t t = t0;
+    while (n < max_iters && (n < 3 || t - t0 < budget_ns)) {
+        fn();
+        ++n;
+        if ((n & 15) == 0 || n < 16) t = monotonic_ns();
+    }
+    t = monotonic_ns();
+    const uint64_t s1 = sc.read();
+    const uint64_t a1 = g_allocs.load(std::memory_order_relaxed);
+    return BenchResult{ n, double(t - t0) / n, s1 > s0 ? double(s1 - s0 - 1) / n : 0.0, double(a1 - a0) / n };
+}
 
-        auto procs = list_processes();
-        for (const auto& p : procs) {
-            std::cout << p.pid << "  " << p.name << "\n";
+static void print_bench(const char *name, const BenchResult& r, bool syscalls) {
+    if (syscalls)
+        std::printf("%-40s %8llu %14.1f %12.2f %11.2f\n", name, static_cast<unsigned long long>(r.iters),
+                    r.ns, r.syscalls, r.allocs);
+    else
+        std::printf("%-40s %8llu %14.1f %12s %11.2f\n", name, static_cast<unsigned long long>(r.iters),
+                    r.ns, "n/d", r.allocs);
+}
 
+#ifndef _WIN32
+// Árbol /proc falso: <dir>/<pid>/{comm,stat,status} para npids procesos.
+static bool make_fake_proc(const std::string& dir, size_t npids) {
+    static const char *names[] = { "kworker/0:1", "nginx", "java", "bash", "postgres", "sshd" };
+    char path[256];
+    for (size_t i = 0; i < npids; ++i) {
+        const int pid = static_cast<int>(i + 1);
+        const char *name = names[i % 6];
+        std::snprintf(path, sizeof(path), "%s/%d", dir.c_str(), pid);
+        if (::mkdir(path, 0755) < 0 && errno != EEXIST) return false;
+        std::snprintf(path, sizeof(path), "%s/%d/comm", dir.c_str(), pid);
+        if (FILE *f = std::fopen(path, "w")) { std::fprintf(f, "%s\n", name); std::fclose(f); } else return false;
+        std::snprintf(path, sizeof(path), "%s/%d/status", dir.c_str(), pid);
+        if (FILE *f = std::fopen(path, "w")) { std::fprintf(f, "Name:\t%s\nState:\tS (sleeping)\n", name); std::fclose(f); }
+        std::snprintf(path, sizeof(path), "%s/%d/stat", dir.c_str(), pid);
+        if (FILE *f = std::fopen(path, "w")) {
+            std::fprintf(f, "%d (%s) S 1 %d %d 0 -1 4194560 1000 0 0 0 %zu %zu 0 0 20 0 1 0 100 "
+                            "10000000 %zu 18446744073709551615 0 0 0 0 0 0 0 0 0 0 0 0 17 %zu 0 0 0 0 0\n",
+                         pid, name, pid, pid, i * 7 % 10000, i * 3 % 5000, 100 + i % 900, i % 64);
+            std::fclose(f);
         }
-        std::cout << "=== Frecuencia actual por núcleo ===\n";
-    
-        if (freqs.empty()) {
-            std::cout << "No se pudo leer la frecuencia por núcleo en este sistema.\n";
-        } else {
+    }
+    return true;
+}
 
-            for (size_t i = 0; i < freqs.size(); ++i) {
-                if (freqs[i] > 0) {
-                    std::cout <<"\x1b["<< changeClr[i] << "m[CPU " << i << "]: " << human_mhz(freqs[i]) << "\x1b[0m\n";
-                } else {
-                    std::cout <<"\x1b["<< changeClr[i] << "m[CPU " << i << "]: N/D\x1b[0m\n";
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) { return ::remove(path); }
+
+static void remove_tree(const std::string& dir) {
+    ::nftw(dir.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+// /proc/cpuinfo falso con ncpu bloques de un Xeon típico.
+static bool make_fake_cpuinfo(const std::string& path, int ncpu) {
+    FILE *f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    for (int i = 0; i < ncpu; ++i) {
+        std::fprintf(f, "processor\t: %d\nvendor_id\t: GenuineIntel\ncpu family\t: 6\nmodel\t\t: 143\n"
+                        "model name\t: Intel(R) Xeon(R) Platinum 8480+\nstepping\t: 8\n"
+                        "microcode\t: 0x2b0004b1\ncpu MHz\t\t: %d.%03d\ncache size\t: 107520 KB\n"
+                        "physical id\t: %d\nsiblings\t: 112\ncore id\t\t: %d\ncpu cores\t: 56\n"
+                        "flags\t\t: fpu vme de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov pat pse36 "
+                        "clflush dts acpi mmx fxsr sse sse2 ss ht tm pbe syscall nx pdpe1gb rdtscp lm "
+                        "constant_tsc art arch_perfmon pebs bts rep_good nopl xtopology nonstop_tsc cpuid "
+                        "aperfmperf tsc_known_freq pni pclmulqdq dtes64 monitor ds_cpl vmx smx est tm2 "
+                        "ssse3 sdbg fma cx16 xtpr pdcm pcid dca sse4_1 sse4_2 x2apic movbe popcnt avx512f\n"
+                        "bogomips\t: 4000.00\naddress sizes\t: 46 bits physical, 57 bits virtual\n\n",
+                     i, 800 + (i * 37) % 3000, i % 1000, i / 112, (i % 112) / 2);
+    }
+    std::fclose(f);
+    return true;
+}
+
+// Jerarquía cgroup v2 falsa: ntop grupos con nchild hijos cada uno.
+static bool make_fake_cgroups(const std::string& root, int ntop, int nchild) {
+    auto add = [](const std::string& dir, int k) {
+        if (::mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) return false;
+        FILE *f = std::fopen((dir + "/cpu.stat").c_str(), "w");
+        if (!f) return false;
+        std::fprintf(f, "usage_usec %d\nuser_usec %d\nsystem_usec %d\nnr_periods %d\n"
+                        "nr_throttled %d\nthrottled_usec %d\n", k * 1000, k * 700, k * 300, k, k / 3, k * 10);
+        std::fclose(f);
+        return true;
+    };
+    if (!add(root, 0)) return false;
+    if (FILE *f = std::fopen((root + "/cgroup.controllers").c_str(), "w")) { std::fputs("cpu io memory\n", f); std::fclose(f); }
+    for (int i = 0; i < ntop; ++i) {
+        const std::string top = root + "/slice" + std::to_string(i);
+        if (!add(top, i)) return false;
+        for (int j = 0; j < nchild; ++j)
+            if (!add(top + "/svc" + std::to_string(j), i * nchild + j)) return false;
+    }
+    return true;
+}
+#endif
+
+static int run_benchmarks(const std::vector<size_t>& pid_sizes, uint64_t max_iters, unsigned threads) {
+    SyscallCounter sc;
+    const bool have_sc = sc.available();
+    const int64_t budget = 2000000000LL;
+    std::printf("inexcpu --bench (syscalls: %s)\n", have_sc ? sc.method() : "n/d");
+    std::printf("%-40s %8s %14s %12s %11s\n", "benchmark", "iters", "ns/op", "syscalls/op", "allocs/op");
+
+    {
+        FrequencySource fs;
+        fs.open();
+        char name[64];
+        std::snprintf(name, sizeof(name), "FrequencySource::sample (%s)", fs.name());
+        print_bench(name, run_bench(sc, [&] { fs.sample(); }, max_iters, budget), have_sc);
+        print_bench("get_core_frequencies_mhz", run_bench(sc, [&] { get_core_frequencies_mhz(); }, max_iters, budget), have_sc);
+    }
+#ifndef _WIN32
+    {
+        // solo vacía los rings: sin eventos nuevos, ninguna syscall
+        TracepointFrequency tp;
+        if (tp.open())
+            print_bench("TracepointFrequency::sample", run_bench(sc, [&] { tp.sample(); }, max_iters, budget), have_sc);
+    }
+#endif
+    {
+        UtilizationSampler us;
+        print_bench("UtilizationSampler::sample", run_bench(sc, [&] { us.sample(); }, max_iters, budget), have_sc);
+    }
+    {
+        print_bench("list_processes", run_bench(sc, [&] { list_processes(); }, max_iters, budget), have_sc);
+        ProcessTable t;
+        t.open();
+        char name[64];
+        std::snprintf(name, sizeof(name), "ProcessTable::refresh (/proc, %s)", t.source_name());
+        print_bench(name, run_bench(sc, [&] { t.refresh(); }, max_iters, budget), have_sc);
+    }
+#ifndef _WIN32
+    char tmpl[] = "/tmp/inexcpu-bench-XXXXXX";
+    if (!::mkdtemp(tmpl)) { std::perror("mkdtemp"); return 1; }
+    const std::string dir = tmpl;
+    {
+        std::vector<double> v;
+        const std::string path = dir + "/cpuinfo";
+        for (int ncpu : { 8, 256 }) {
+            if (!make_fake_cpuinfo(path, ncpu)) break;
+            char name[64];
+            CpuinfoReader reader(path.c_str());
+            std::snprintf(name, sizeof(name), "CpuinfoReader::read (%d cpus)", ncpu);
+            print_bench(name, run_bench(sc, [&] { reader.read(v); }, max_iters, budget), have_sc);
+        }
+    }
+    {
+        const std::string root = dir + "/cgroup";
+        CgroupTable cg;
+        if (make_fake_cgroups(root, 100, 9) && cg.open(root.c_str())) {
+            std::vector<CgroupSample> out;
+            char name[64];
+            std::snprintf(name, sizeof(name), "CgroupTable::refresh+top (%zu grupos)", cg.size());
+            print_bench(name, run_bench(sc, [&] { cg.refresh(); cg.top(10, out); }, max_iters, budget), have_sc);
+        }
+    }
+    for (size_t n : pid_sizes) {
+        const std::string root = dir + "/proc" + std::to_string(n);
+        ::mkdir(root.c_str(), 0755);
+        if (!make_fake_proc(root, n)) { std::fprintf(stderr, "No se pudo crear %s\n", root.c_str()); break; }
+        // síncrono con --threads y, si el kernel lo permite, io_uring
+        for (bool uring : { false, true }) {
+            ProcessTable t(root);
+            t.set_uring(uring);
+            t.open(ProcfsProcesses::kName);
+            if (uring && !t.uring()) break;
+            t.set_threads(threads);
+            char mode[32], name[64];
+            if (uring) std::snprintf(mode, sizeof(mode), "io_uring");
+            else std::snprintf(mode, sizeof(mode), "%u hilos", threads);
+            std::snprintf(name, sizeof(name), "ProcessTable cold (%zu pids, %s)", n, mode);
+            print_bench(name, run_bench(sc, [&] {
+                ProcessTable c(root);
+                c.set_uring(uring);
+                c.open(ProcfsProcesses::kName);
+                c.set_threads(threads);
+                c.refresh();
+            }, max_iters, budget), have_sc);
+            std::snprintf(name, sizeof(name), "ProcessTable steady (%zu pids, %s)", n, mode);
+            print_bench(name, run_bench(sc, [&] { t.refresh(); }, max_iters, budget), have_sc);
+        }
+    }
+    remove_tree(dir);
+#endif
+    {
+        // frame típico: 128 núcleos y 25 procesos; cambia un núcleo por op
+        Sample s;
+        s.mhz.assign(128, 2400.0);
+        s.util.assign(128, CoreUtil{ 12.5, 0.1, 0.2, 0.0 });
+        s.top.resize(25);
+        for (size_t i = 0; i < s.top.size(); ++i) {
+            s.top[i] = ProcSample{ static_cast<long long>(1000 + i), 25.0 - i, 1024ull * (i + 1), {} };
+            std::snprintf(s.top[i].name, sizeof(s.top[i].name), "worker-%zu", i);
+        }
+        int clr[1] = { 37 };
+        Renderer r(false);
+        View view;
+        size_t k = 0;
+        print_bench("render_sample (128 cpus, diff)", run_bench(sc, [&] {
+            s.mhz[k++ % s.mhz.size()] += 1.0;
+            render_sample(r, s, clr, 1, view);
+        }, max_iters, budget), have_sc);
+        // una muestra por segundo: en la ventana de 10 s caduca una rodaja por op
+        FreqStats fs;
+        print_bench("FreqStats::add (128 cpus, 3 ventanas)", run_bench(sc, [&] {
+            s.t_ns += 1000000000LL;
+            s.mhz[k++ % s.mhz.size()] += 25.0;
+            fs.add(s);
+        }, max_iters, budget), have_sc);
+    }
+    return 0;
+}
+
+// Cuenta las reservas de memoria; coste: un incremento relajado.
+void *operator new(std::size_t n) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"  // falso positivo con new reemplazado
+#endif
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// ----------------------------- Main -----------------------------
+int main(int argc, char **argv) {
+    bool daemon = false;
+    int interval_ms = 1000;
+    const char *record_path = nullptr;
+    const char *replay_path = nullptr;
+    const char *listen_spec = nullptr;
+    const char *agent_spec = nullptr;
+    const char *aggregate_spec = nullptr;
+    View view;
+    const char *freq_source = nullptr;
+    const char *proc_source = nullptr;
+    unsigned threads = 1;
+    bool uring = true;
+    ProcQuery query;
+    bool cgroups_view = false;
+    bool thermal_view = false;
+    bool adaptive = false;
+    int format = kOutTui;
+    bool interactive = false;
+    uint64_t count = 0;               // --count / --once; 0 = sin límite
+    std::vector<proc_id> tasks;       // --tasks
+    const size_t kMaxTasks = 8;
+    int pin_cpu = -1;
+    bool realtime = false;
+    std::vector<int64_t> windows;     // vacío: las de FreqStats
+    bool bench = false;
+    std::vector<size_t> bench_pids = { 1000, 10000 };
+    uint64_t bench_iters = 5000;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--daemon") daemon = true;
+        else if (a == "--interval" && i + 1 < argc) {
+            interval_ms = std::atoi(argv[++i]);
+            if (interval_ms < 10 || interval_ms > 60000) {
+                std::fprintf(stderr, "--interval debe estar entre 10 y 60000 ms\n");
+                return 2;
+            }
+        }
+        else if (a == "--record" && i + 1 < argc) record_path = argv[++i];
+        else if (a == "--replay" && i + 1 < argc) replay_path = argv[++i];
+        else if (a == "--listen" && i + 1 < argc) listen_spec = argv[++i];
+        else if (a == "--agent" && i + 1 < argc) agent_spec = argv[++i];
+        else if (a == "--aggregate" && i + 1 < argc) aggregate_spec = argv[++i];
+        else if (a == "--group" && i + 1 < argc) {
+            view.group = parse_level(argv[++i]);
+            if (view.group < 0) { std::fprintf(stderr, "--group: nivel desconocido %s\n", argv[i]); return 2; }
+        }
+        else if (a == "--expand" && i + 1 < argc) {
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ',')) view.expand.push_back(std::atoi(item.c_str()));
+        }
+        else if (a == "--threads" && i + 1 < argc) {
+            const int n = std::atoi(argv[++i]);
+            if (n < 1 || n > 64) { std::fprintf(stderr, "--threads debe estar entre 1 y 64\n"); return 2; }
+            threads = static_cast<unsigned>(n);
+        }
+        else if (a == "--no-uring") uring = false;
+        else if (a == "--tasks" && i + 1 < argc) {
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                const long pid = std::atol(item.c_str());
+                if (pid <= 0 || tasks.size() >= kMaxTasks) {
+                    std::fprintf(stderr, "--tasks: se espera una lista de hasta %zu PIDs, p. ej. 1234,5678\n", kMaxTasks);
+                    return 2;
                 }
+                tasks.push_back(static_cast<proc_id>(pid));
+            }
+        }
+        else if (a == "--top" && i + 1 < argc) {
+            const int n = std::atoi(argv[++i]);
+            if (n < 0 || n > 1000) { std::fprintf(stderr, "--top debe estar entre 0 y 1000\n"); return 2; }
+            query.top = static_cast<size_t>(n);
+        }
+        else if (a == "--sort" && i + 1 < argc) {
+            query.sort = parse_sort(argv[++i]);
+            if (query.sort < 0) { std::fprintf(stderr, "--sort: orden desconocido %s (cpu|rss|pid|name)\n", argv[i]); return 2; }
+        }
+        else if (a == "--filter" && i + 1 < argc) {
+            if (!query.parse_filter(argv[++i])) {
+                std::fprintf(stderr, "--filter: se espera name=~REGEX o name=NOMBRE (%s)\n", argv[i]);
+                return 2;
+            }
+        }
+        else if (a == "--cgroups") cgroups_view = true;
+        else if (a == "--thermal") thermal_view = true;
+        else if (a == "--adaptive") adaptive = true;
+        else if (a == "--format" && i + 1 < argc) {
+            format = parse_format(argv[++i]);
+            if (format < 0) {
+                std::fprintf(stderr, "--format: json, csv o text\n");
+                return 2;
+            }
+        }
+        else if (a == "--interactive" || a == "-i") interactive = true;
+        else if (a == "--once") count = 1;
+        else if (a == "--count" && i + 1 < argc) {
+            count = std::strtoull(argv[++i], nullptr, 10);
+            if (count == 0) { std::fprintf(stderr, "--count debe ser mayor que 0\n"); return 2; }
+        }
+        else if (a == "--pin-cpu" && i + 1 < argc) {
+            char *end = nullptr;
+            pin_cpu = static_cast<int>(std::strtol(argv[++i], &end, 10));
+            if (!*argv[i] || *end || pin_cpu < 0) {
+                std::fprintf(stderr, "--pin-cpu: se espera un id de CPU\n");
+                return 2;
+            }
+        }
+        else if (a == "--rt") realtime = true;
+        else if (a == "--budget" && i + 1 < argc) {
+            view.budget_pct = std::atof(argv[++i]);
+            if (view.budget_pct <= 0 || view.budget_pct > 100) {
+                std::fprintf(stderr, "--budget: se espera un %% de CPU entre 0 y 100\n");
+                return 2;
+            }
+        }
+        else if (a == "--windows" && i + 1 < argc) {
+            if (!parse_windows(argv[++i], windows)) {
+                std::fprintf(stderr, "--windows: se espera una lista como 10s,1m,5m (hasta 8)\n");
+                return 2;
+            }
+        }
+        else if (a == "--cgroup" && i + 1 < argc) {
+            query.cgroup = argv[++i];
+#ifdef _WIN32
+            std::fprintf(stderr, "--cgroup: no disponible en Windows, se ignora\n");
+            query.cgroup.clear();
+#endif
+        }
+        else if (a == "--perf") freq_source = PerfFrequency::kName;
+        else if (a == "--freq-source" && i + 1 < argc) {
+            freq_source = argv[++i];
+            if (!FrequencyBackends::known(freq_source)) {
+                std::fprintf(stderr, "--freq-source: %s no existe (%s)\n", freq_source, FrequencyBackends::names().c_str());
+                return 2;
+            }
+        }
+        else if (a == "--proc-source" && i + 1 < argc) {
+            proc_source = argv[++i];
+            if (!ProcessBackends::known(proc_source)) {
+                std::fprintf(stderr, "--proc-source: %s no existe (%s)\n", proc_source, ProcessBackends::names().c_str());
+                return 2;
             }
         }
+        else if (a == "--bench") bench = true;
+        else if (a == "--bench-iters" && i + 1 < argc) bench_iters = std::strtoull(argv[++i], nullptr, 10);
+        else if (a == "--bench-pids" && i + 1 < argc) {
+            bench_pids.clear();
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ','))
+                if (size_t n = std::strtoul(item.c_str(), nullptr, 10)) bench_pids.push_back(n);
+        }
+        else if (a == "-h" || a == "--help") { usage_text(argv[0]); return 0; }
+        else { std::fprintf(stderr, "Opción desconocida: %s\n", argv[i]); usage_text(argv[0]); return 2; }
+    }
+
+    if (bench) return run_benchmarks(bench_pids, bench_iters, threads);
+    if (count && format == kOutTui) format = kOutText;   // --once/--count son para scripts
+    if (pin_cpu >= 0 && !pin_to_cpu(pin_cpu)) {
+        std::fprintf(stderr, "--pin-cpu: no se pudo fijar en la CPU %d (%s)\n", pin_cpu, std::strerror(errno));
+        return 1;
+    }
+#ifdef _WIN32
+    WSADATA wsa;
+    if (listen_spec || agent_spec || aggregate_spec) WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+    std::signal(SIGPIPE, SIG_IGN);  // un par que cierra no debe matar el proceso
+#endif
+    if (aggregate_spec) {
+        // solo agregador: no se muestrea esta máquina
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+        FleetAggregator fleet;
+        if (!fleet.listen(aggregate_spec)) return 1;
+        fleet.run(interval_ms, !daemon);
+        return 0;
+    }
+    view.interval_ms = interval_ms;
+    CpuTopology topo;
+    if (load_topology(topo)) view.topo = &topo;
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    srand(time(NULL));  
+    // Fuentes: la pedida, o la primera que funcione en esta máquina.
+    FrequencySource sampler;
+    if (!replay_path && freq_source && !sampler.open(freq_source))
+        std::fprintf(stderr, "--freq-source: %s no disponible (%s)\n", freq_source, std::strerror(errno));
+    if (sampler.empty()) sampler.open();
+    UtilizationSampler usage;
+    ThermalSampler thermal;
+    if (!replay_path && thermal_view && !thermal.open())
+        std::fprintf(stderr, "--thermal: no hay sensores, RAPL ni contadores de throttling\n");
+    ProcessTable table;
+    table.set_uring(uring);
+    if (proc_source && !table.open(proc_source)) {
+        std::fprintf(stderr, "--proc-source: %s no disponible\n", proc_source);
+        table.open();
+    }
+    table.set_threads(threads);
+    table.set_query(query);
 #ifdef _WIN32
-        std::system("cls");
+    if (!tasks.empty()) std::fprintf(stderr, "--tasks: no disponible en Windows, se ignora\n");
 #else
-        std::system("clear");
+    table.set_tasks(tasks);
+#endif
+    CgroupTable cgroups;
+    const size_t kTopCgroups = 10;
+    if (!replay_path && cgroups_view && !cgroups.open())
+        std::fprintf(stderr, "--cgroups: no hay jerarquía cgroup v2 con cpu.stat\n");
+    auto fc = sampler.sample();
+    // un color por id de CPU para todas las posibles: una CPU que entra en
+    // caliente ya tiene el suyo y el ring no se redimensiona
+    const size_t possible = std::max<size_t>(fc.size(), cpu_possible());
+    std::vector<int> changeClr(possible ? possible : 1);
+    for (size_t i = 0; i < changeClr.size(); i++) {
+        changeClr[i] = (rand() % 14) + 31;
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    RecordReader reader;
+    if (replay_path && !reader.open(replay_path)) {
+        std::fprintf(stderr, "No se pudo abrir la grabación %s\n", replay_path);
+        return 1;
+    }
+    Recorder recorder;
+    if (record_path && !recorder.open(record_path)) return 1;
+    MetricsExporter exporter(view.topo);
+    if (!windows.empty()) {
+        exporter.set_windows(windows);
+        view.freq.set_windows(windows);
+    }
+    if (listen_spec && !exporter.listen(listen_spec)) return 1;
+    AgentSender agent;
+    if (agent_spec && !agent.open(agent_spec)) return 1;
+
+    size_t max_cpus = std::max<size_t>(possible, std::thread::hardware_concurrency());
+    view.source = replay_path ? "replay" : sampler.name();
+    if (replay_path) max_cpus = std::max(max_cpus, reader.max_cpus());
+    SampleRing ring(64, max_cpus, std::max<size_t>(query.top, 25), kTopCgroups,  // 25: las grabaciones antiguas
+                    tasks.size() * kThreadsPerTask);
+    AdaptivePolicy policy(interval_ms);
+    ProcSnapshot snapshot;
+    std::thread producer = replay_path
+        ? std::thread(replay_loop, std::ref(reader), std::ref(ring))
+        : std::thread([&] {
+#ifdef _WIN32
+              if (pin_cpu >= 0) pin_to_cpu(pin_cpu);   // afinidad de grupo: por hilo
 #endif
+              if (realtime && !set_realtime())
+                  std::fprintf(stderr, "--rt: sin prioridad de tiempo real (%s)\n", std::strerror(errno));
+              sampler_loop(sampler, usage, thermal, table, cgroups, kTopCgroups, ring, interval_ms,
+                           adaptive ? &policy : nullptr, interactive ? &snapshot : nullptr);
+          });
+    std::thread recorder_thread;
+    if (record_path) recorder_thread = std::thread([&] { recorder.run(ring); });
+    std::thread exporter_thread;
+    if (listen_spec) exporter_thread = std::thread([&] { exporter.run(ring); });
+    std::thread agent_thread;
+    if (agent_spec) agent_thread = std::thread([&] { agent.run(ring); });
+
+    if (format != kOutTui) {
+        SampleWriter writer(format, count, !replay_path);
+        writer.run(ring);
+    } else if (daemon) {
+        while (!g_stop) ring.wait(ring.head(), std::chrono::milliseconds(1000));
+    } else if (interactive) {
+        // teclas y muestras en el mismo bucle: una tecla se pinta en cuanto
+        // llega, las muestras como mucho a 20 fps
+        const int kFrameMs = 50;
+        RawTerminal term;
+        Renderer screen;
+        Viewport vp;
+        vp.sort = query.sort;
+        Sample s;
+        SelfMeter self;
+        int64_t last_self = 0;
+        while (!g_stop) {
+            bool redraw = false;
+            const int k = term.read_key(kFrameMs);
+            if (k == 'q' || k == 'Q') break;
+            if (k != kKeyNone) redraw = vp.key(k);
+            if (view.freq.catch_up(ring, s)) {
+                redraw = true;
+                if (replay_path) {   // las grabaciones solo traen el top
+                    vp.procs = s.top;
+                    vp.dirty = true;
+                }
+            }
+            if (snapshot.take(vp.procs)) vp.dirty = redraw = true;
+            if (monotonic_ns() - last_self >= 1000000000LL) {
+                view.self = self.sample();
+                last_self = monotonic_ns();
+            }
+            if (redraw && s.seq) render_interactive(screen, s, changeClr.data(), changeClr.size(), view, vp);
+        }
+        g_stop = true;
+    } else {
+        // la TUI pinta la última muestra, a 20 fps como mucho
+        const int64_t kMinFrameNs = 50 * 1000000LL;
+        Renderer screen;
+        Sample s;
+        SelfMeter self;
+        int64_t last_frame = 0, last_self = 0;
+        while (!g_stop) {
+            ring.wait(s.seq, std::chrono::milliseconds(1000));
+            const int64_t wait = last_frame + kMinFrameNs - monotonic_ns();
+            if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+            // el coste propio se mide a 1 Hz: con ráfagas a 20 fps sería ruido
+            if (monotonic_ns() - last_self >= 1000000000LL) {
+                view.self = self.sample();
+                last_self = monotonic_ns();
+            }
+            if (view.freq.catch_up(ring, s)) {
+                render_sample(screen, s, changeClr.data(), changeClr.size(), view);
+                last_frame = monotonic_ns();
+            }
+        }
+    }
 
-    } while(1);
+    producer.join();
+    if (recorder_thread.joinable()) recorder_thread.join();
+    if (exporter_thread.joinable()) exporter_thread.join();
+    if (agent_thread.joinable()) agent_thread.join();
     return 0;
 }